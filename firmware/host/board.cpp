@@ -0,0 +1,367 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Simulated implementation of src/sys/board.hpp for the host build.
+ * The power stage is simulated by the model from host/plant.hpp; the ADC readings are quantized and scaled
+ * exactly like on the real hardware.
+ */
+
+#include "sim.hpp"
+#include "plant.hpp"
+#include <sys/board.hpp>
+#include <sys/profiler.hpp>
+#include <build_config.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+namespace board
+{
+namespace
+{
+
+constexpr double AdcReferenceVolts = 3.3;
+constexpr unsigned AdcResolutionBits = 10;
+
+constexpr double SupplyDividerRatio = 11.12;
+constexpr double OutputDividerRatio = 200.0;
+
+double pending_time_ns;
+
+std::uint64_t pump_finished_at_usec;
+
+unsigned pump_stop_voltage;
+
+constexpr unsigned FlashPageWriteUSec = 1000;
+
+std::uint64_t syslog_sent_at_usec;     ///< When the UART finishes transmitting the queued messages
+std::uint32_t syslog_dropped_messages;
+
+#if HARDPOINT_FAST_PATH
+std::uint16_t hardpoint_fast_path_data_type_id;
+std::uint8_t hardpoint_fast_path_hardpoint_id;
+bool hardpoint_command_latched;
+std::uint16_t hardpoint_command;
+
+/**
+ * Same matching as the CAN interrupt of the target, see src/sys/board.cpp.
+ */
+void latchHardpointCommand(const uavcan::CanFrame& frame)
+{
+    if (!frame.isExtended() || frame.isRemoteTransmissionRequest() || frame.isErrorFrame() || (frame.dlc != 4) ||
+        ((frame.id & 0x80U) != 0) || (((frame.id >> 8) & 0xFFFFU) != hardpoint_fast_path_data_type_id) ||
+        (frame.data[0] != hardpoint_fast_path_hardpoint_id) || ((frame.data[3] & 0xE0U) != 0xC0U))
+    {
+        return;
+    }
+
+    hardpoint_command = std::uint16_t(frame.data[1] | (frame.data[2] << 8));
+    hardpoint_command_latched = true;
+}
+#endif
+
+void consumeNanoseconds(double ns)
+{
+    pending_time_ns += ns;
+    const auto usec = static_cast<std::uint64_t>(pending_time_ns / 1000.0);
+    pending_time_ns -= double(usec) * 1000.0;
+    sim::advanceTime(usec);
+}
+
+void updateSupplyVoltage()
+{
+    plant::setSupplyVoltage(sim::getEnvironment().supply_voltage_mV / 1000.0);
+}
+
+unsigned readAdc(double pin_voltage)
+{
+    const double counts = std::round(pin_voltage / AdcReferenceVolts * double(1U << AdcResolutionBits));
+    return unsigned(std::min(std::max(counts, 0.0), double((1U << AdcResolutionBits) - 1U)));
+}
+
+void fireThyristors(bool positive)
+{
+    const auto voltage = static_cast<unsigned>(plant::getOutputVoltage());
+    (void)plant::fireThyristors();
+
+    for (auto l : sim::getListeners())
+    {
+        l->onMagnetSwitched(positive, voltage);
+    }
+}
+
+}
+
+void die()
+{
+    std::fprintf(stderr, "board::die() at %llu usec\n", static_cast<unsigned long long>(sim::getTimeUSec()));
+    std::exit(1);
+}
+
+void restart()
+{
+    std::fprintf(stderr, "board::restart() at %llu usec\n", static_cast<unsigned long long>(sim::getTimeUSec()));
+    std::exit(0);
+}
+
+void readUniqueID(UniqueID& out_uid)
+{
+    for (unsigned i = 0; i < out_uid.size(); i++)
+    {
+        out_uid[i] = static_cast<std::uint8_t>(i);
+    }
+}
+
+bool tryReadDeviceSignature(DeviceSignature&)
+{
+    return false;
+}
+
+bool tryReadPersistentConfig(PersistentConfig& out_config)
+{
+    const auto& stored = sim::getEnvironment().persistent_config;
+    if (stored == PersistentConfig())
+    {
+        return false;
+    }
+    out_config = stored;
+    return true;
+}
+
+bool writePersistentConfig(const PersistentConfig& config)
+{
+    auto& stored = sim::getEnvironment().persistent_config;
+    if (!(stored == config))
+    {
+        stored = config;
+        sim::advanceTime(FlashPageWriteUSec);
+    }
+    return true;
+}
+
+bool startCanBitRateProbe(std::uint32_t) { return true; }
+
+bool isCanBitRateConfirmed() { return true; }           // The virtual bus runs at any bit rate
+
+void stopCanBitRateProbe() { }
+
+#if HARDPOINT_FAST_PATH
+void enableHardpointCommandFastPath(std::uint16_t data_type_id, std::uint8_t hardpoint_id)
+{
+    hardpoint_fast_path_data_type_id = data_type_id;
+    hardpoint_fast_path_hardpoint_id = hardpoint_id;
+    sim::setCanRxInterruptHandler(&latchHardpointCommand);
+}
+
+bool takeHardpointCommand(std::uint16_t& out_command)
+{
+    out_command = hardpoint_command;
+    const bool ret = hardpoint_command_latched;
+    hardpoint_command_latched = false;
+    return ret;
+}
+#endif
+
+void resetWatchdog()
+{
+    sim::handleLoopIteration();
+}
+
+void sleepUntilInterrupt()
+{
+    sim::sleep(IdleWakeupPeriodUSec);
+}
+
+void setStatusLed(bool) { }
+
+void setCanLed(bool) { }
+
+void startPump(std::uint_fast16_t iterations,
+               std::uint_fast8_t delay_on,
+               std::uint_fast8_t delay_off)
+{
+    const double on_ns  = double(delay_on  * PumpIterationNs + PumpOnOverheadNs) *
+                          build_config::NumDrivenPumpSwitches / build_config::NumPumpSwitches;
+    const double off_ns = double(delay_off * PumpIterationNs + PumpOffOverheadNs);
+
+    // Lowest measured voltage that the ADC interrupt reads as the stop voltage, see getOutVoltageInVolts()
+    double stop_voltage_V = INFINITY;
+    if (pump_stop_voltage > 0)
+    {
+        const unsigned stop_counts = ((pump_stop_voltage << AdcResolutionBits) + (3300U / 5U) - 1U) / (3300U / 5U);
+        stop_voltage_V = (double(stop_counts) - 0.5) / double(1U << AdcResolutionBits) * AdcReferenceVolts *
+                         OutputDividerRatio;
+    }
+
+    updateSupplyVoltage();
+    const auto res = plant::runPump(unsigned(iterations), on_ns * 1e-9, off_ns * 1e-9,
+                                    stop_voltage_V, 1.0 / AdcScansPerSecond);
+
+#if PUMP_TIMER
+    // The burst is applied to the power stage at once, but the firmware keeps running until it is finished
+    pump_finished_at_usec = sim::getTimeUSec() + static_cast<std::uint64_t>(res.duration_s * 1e6);
+#else
+    consumeNanoseconds(res.duration_s * 1e9);
+    pump_finished_at_usec = sim::getTimeUSec();
+#endif
+
+    for (auto l : sim::getListeners())
+    {
+        l->onPumpBurst(res.iterations, static_cast<std::uint64_t>(res.duration_s * 1e6), res.input_energy_J);
+    }
+}
+
+bool isPumpRunning()
+{
+    return sim::getTimeUSec() < pump_finished_at_usec;
+}
+
+void setPumpStopVoltage(unsigned volts)
+{
+    pump_stop_voltage = volts;
+}
+
+bool isPumpStopVoltageReached()
+{
+    return (pump_stop_voltage > 0) && (getOutVoltageInVolts() >= pump_stop_voltage);
+}
+
+void setMagnetPos()
+{
+    fireThyristors(true);
+    delayUSec(20);
+}
+
+void setMagnetNeg()
+{
+    fireThyristors(false);
+    delayUSec(20);
+}
+
+std::uint8_t readDipSwitch()
+{
+    return sim::getEnvironment().dip_switch;
+}
+
+bool hadButtonPressEvent()
+{
+    auto& env = sim::getEnvironment();
+    if (env.pending_button_presses > 0)
+    {
+        env.pending_button_presses--;
+        return true;
+    }
+    return false;
+}
+
+unsigned getSupplyVoltageInMillivolts()
+{
+    updateSupplyVoltage();
+    const unsigned raw = readAdc(plant::getMeasuredSupplyVoltage() / SupplyDividerRatio);
+
+    // Same arithmetic as on the hardware, except that the two-sample averaging is not needed here
+    unsigned x = ((raw * 2U) * 3300U) >> AdcResolutionBits;
+    x = (x * 364380U) >> 16;
+    return std::max(SupplyVoltageMinMillivolts, x);
+}
+
+unsigned getOutVoltageInVolts()
+{
+    const unsigned raw = readAdc(plant::getMeasuredOutputVoltage() / OutputDividerRatio);
+    return (raw * (3300U / 5U)) >> AdcResolutionBits;
+}
+
+std::uint32_t getAdcScanCount()
+{
+    return static_cast<std::uint32_t>(sim::getTimeUSec() * AdcScansPerSecond / 1000000U);
+}
+
+PwmInput getPwmInput()
+{
+    return sim::getEnvironment().pwm_input;
+}
+
+void delayUSec(std::uint8_t usec)
+{
+    sim::advanceTime(usec);
+}
+
+void delayMSec(unsigned msec)
+{
+    profiler::ScopedSection section(profiler::Section::Delay);
+
+    sim::advanceTime(msec * 1000ULL);
+}
+
+void syslog(const char* msg)
+{
+    profiler::ScopedSection section(profiler::Section::Syslog);
+
+    // The ring buffer is drained by the UART in the background, so only the bytes not yet sent are queued
+    const std::uint64_t now = sim::getTimeUSec();
+    const std::uint64_t queued = (syslog_sent_at_usec > now) ?
+                                 ((syslog_sent_at_usec - now + sim::UartByteUSec - 1U) / sim::UartByteUSec) : 0U;
+    const auto len = std::strlen(msg);
+    if (queued + len > SyslogBufferSize)
+    {
+        syslog_dropped_messages++;
+        return;
+    }
+
+    if (sim::getEnvironment().echo_syslog)
+    {
+        std::fputs(msg, stdout);
+    }
+    syslog_sent_at_usec = std::max(syslog_sent_at_usec, now) + len * sim::UartByteUSec;
+}
+
+void syslog(const char* prefix, long long integer_value, const char* suffix)
+{
+    char buf[24];
+    std::snprintf(buf, sizeof(buf), "%lld", integer_value);
+
+    syslog(prefix);
+    syslog(&buf[0]);
+    syslog(suffix);
+}
+
+std::uint32_t getSyslogDroppedMessages()
+{
+    return syslog_dropped_messages;
+}
+
+#if TOKENIZED_SYSLOG
+
+void syslogToken(const char* entry)
+{
+    syslog(entry);
+}
+
+void syslogToken(const char* entry, long long integer_value)
+{
+    // The dictionary is loaded on the host, so the text is rebuilt here like tools/syslog_decode.py does
+    const char* const placeholder = std::strstr(entry, "%d");
+    const std::string prefix(entry, placeholder);
+    syslog(prefix.c_str(), integer_value, placeholder + 2);
+}
+
+#endif
+
+}
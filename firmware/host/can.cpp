@@ -0,0 +1,145 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.hpp"
+#include <uavcan_lpc11c24/can.hpp>
+#include <uavcan_lpc11c24/clock.hpp>
+#include <algorithm>
+
+namespace uavcan_lpc11c24
+{
+namespace
+{
+
+constexpr uavcan::uint32_t BitRate = 1000000;
+
+}
+
+CanDriver CanDriver::self;
+
+uavcan::uint32_t CanDriver::detectBitRate(void (*)())
+{
+    return BitRate;
+}
+
+int CanDriver::init(uavcan::uint32_t)
+{
+    return 0;
+}
+
+bool CanDriver::hadActivity()
+{
+    const bool ret = had_activity_;
+    had_activity_ = false;
+    return ret;
+}
+
+uavcan::int16_t CanDriver::send(const uavcan::CanFrame& frame, uavcan::MonotonicTime, uavcan::CanIOFlags)
+{
+    had_activity_ = true;
+
+    for (auto l : sim::getListeners())
+    {
+        l->onCanFrameTransmitted(frame);
+    }
+    return 1;
+}
+
+bool CanDriver::isAcceptedByFilters(const uavcan::CanFrame& frame) const
+{
+    if (num_filters_ == 0)
+    {
+        return true;
+    }
+    for (unsigned i = 0; i < num_filters_; i++)
+    {
+        if (((frame.id ^ filters_[i].id) & filters_[i].mask) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uavcan::int16_t CanDriver::receive(uavcan::CanFrame& out_frame,
+                                   uavcan::MonotonicTime& out_ts_monotonic,
+                                   uavcan::UtcTime& out_ts_utc,
+                                   uavcan::CanIOFlags& out_flags)
+{
+    // The frames rejected by the message objects never reach the software
+    while (true)
+    {
+        if (!sim::popInjectedCanFrame(out_frame))
+        {
+            return 0;
+        }
+        if (isAcceptedByFilters(out_frame))
+        {
+            break;
+        }
+        num_frames_rejected_++;
+    }
+
+    num_frames_accepted_++;
+
+    had_activity_ = true;
+
+    for (auto l : sim::getListeners())
+    {
+        l->onCanFrameReceived(out_frame);
+    }
+
+    out_ts_monotonic = clock::getMonotonic();
+    out_ts_utc = uavcan::UtcTime();
+    out_flags = 0;
+    return 1;
+}
+
+uavcan::int16_t CanDriver::select(uavcan::CanSelectMasks& inout_masks,
+                                  const uavcan::CanFrame* (&)[uavcan::MaxCanIfaces],
+                                  uavcan::MonotonicTime)
+{
+    // The virtual bus never blocks - the transmission completes immediately
+    inout_masks.read  = (sim::getNumInjectedCanFrames() > 0) ? 1 : 0;
+    inout_masks.write = 1;
+    return 1;
+}
+
+uavcan::int16_t CanDriver::configureFilters(const uavcan::CanFilterConfig* filter_configs,
+                                            uavcan::uint16_t num_configs)
+{
+    if (num_configs > MaxFilters)
+    {
+        return -1;
+    }
+    std::copy(filter_configs, filter_configs + num_configs, filters_);
+    num_filters_ = num_configs;
+    return 0;
+}
+
+uavcan::uint16_t CanDriver::getNumFilters() const
+{
+    return MaxFilters;
+}
+
+uavcan::ICanIface* CanDriver::getIface(uavcan::uint8_t iface_index)
+{
+    return (iface_index == 0) ? this : nullptr;
+}
+
+}
@@ -0,0 +1,49 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.hpp"
+#include <uavcan_lpc11c24/clock.hpp>
+
+namespace uavcan_lpc11c24
+{
+namespace clock
+{
+
+void init() { }
+
+uavcan::MonotonicTime getMonotonic()
+{
+    return uavcan::MonotonicTime::fromUSec(sim::getTimeUSec());
+}
+
+uavcan::UtcTime getUtc()
+{
+    return uavcan::UtcTime();
+}
+
+void adjustUtc(uavcan::UtcDuration) { }
+
+}
+
+SystemClock& SystemClock::instance()
+{
+    static SystemClock self;
+    return self;
+}
+
+}
@@ -0,0 +1,148 @@
+#
+# Copyright (c) 2016 Zubax Robotics, zubax.com
+# Distributed under the MIT License, available in the file LICENSE.
+#
+# Host build of the application against the simulated board, see host/sim.hpp.
+# Invoked from the firmware directory via 'make host'.
+#
+
+# Each executable has its own entry point; everything else is shared
+ENTRYSRC := host/simulator.cpp                   \
+            host/sweep.cpp                       \
+            host/latency_bench.cpp
+
+CPPSRC := src/main.cpp                           \
+          src/params.cpp                         \
+          src/sys/profiler.cpp                   \
+          $(wildcard src/magnet/*.cpp)           \
+          $(filter-out $(ENTRYSRC), $(wildcard host/*.cpp))
+
+DEF = -DFW_VERSION_MAJOR=1                       \
+      -DFW_VERSION_MINOR=0                       \
+      -DHW_VERSION_MAJOR=3                       \
+      -DGIT_HASH=0
+
+# The LPC11C24 driver is replaced with its host counterpart from host/include
+INC = -Ihost/include                             \
+      -Isrc
+
+# ProDropper support
+PRODROPPER ?= 0
+ifneq ($(PRODROPPER),0)
+    DEF += -DPRODROPPER=1
+endif
+
+# Pump switching by the hardware timer, see src/sys/board.hpp
+PUMP_TIMER ?= 0
+ifneq ($(PUMP_TIMER),0)
+    DEF += -DPUMP_TIMER=1
+endif
+
+# Closed loop pump timing, see src/magnet/charger.cpp
+ADAPTIVE_PUMP_TIMING ?= 0
+ifneq ($(ADAPTIVE_PUMP_TIMING),0)
+    DEF += -DADAPTIVE_PUMP_TIMING=1
+endif
+
+# Capacitor kept charged between the commands, see src/magnet/magnet.cpp
+STANDBY_PRECHARGE ?= 0
+ifneq ($(STANDBY_PRECHARGE),0)
+    DEF += -DSTANDBY_PRECHARGE=1
+endif
+
+# Main loop profiler, see src/sys/profiler.hpp
+LOOP_PROFILER ?= 0
+ifneq ($(LOOP_PROFILER),0)
+    DEF += -DLOOP_PROFILER=1
+endif
+
+# Binary syslog records, the simulated board prints the text, see src/sys/board.hpp
+TOKENIZED_SYSLOG ?= 0
+ifneq ($(TOKENIZED_SYSLOG),0)
+    DEF += -DTOKENIZED_SYSLOG=1
+endif
+
+# Hardpoint commands decoded at the reception, like in the CAN interrupt, see src/sys/board.hpp
+HARDPOINT_FAST_PATH ?= 0
+ifneq ($(HARDPOINT_FAST_PATH),0)
+    DEF += -DHARDPOINT_FAST_PATH=1
+endif
+
+#
+# UAVCAN library
+#
+
+DEF += -DUAVCAN_TINY=1 -DUAVCAN_CPP_VERSION=UAVCAN_CPP11
+
+include libuavcan/libuavcan/include.mk
+CPPSRC += $(LIBUAVCAN_SRC)
+INC += -I$(LIBUAVCAN_INC)
+
+$(info $(shell $(LIBUAVCAN_DSDLC) $(UAVCAN_DSDL_DIR)))
+INC += -Idsdlc_generated
+
+#
+# Build configuration
+#
+
+BUILDDIR = build_host
+OBJDIR = $(BUILDDIR)/obj
+DEPDIR = $(BUILDDIR)/dep
+
+# The firmware sources are written for a 32-bit target and are not warning-free on a 64-bit host
+FLAGS = -O2 -g -Wall -Wextra -Wno-attributes -Wundef
+
+CPPFLAGS = $(FLAGS) -MD -MP -MF $(DEPDIR)/$(@F).d -std=c++14
+
+CPPOBJ = $(addprefix $(OBJDIR)/, $(notdir $(CPPSRC:.cpp=.o)))
+ENTRYOBJ = $(addprefix $(OBJDIR)/, $(notdir $(ENTRYSRC:.cpp=.o)))
+
+# The charge sweep does not need the application, only the magnet and the charger
+SWEEPOBJ = $(filter-out $(OBJDIR)/main.o, $(CPPOBJ))
+
+VPATH = $(sort $(dir $(CPPSRC) $(ENTRYSRC)))
+
+EXE = $(BUILDDIR)/firmware
+SWEEP = $(BUILDDIR)/charge_sweep
+BENCH = $(BUILDDIR)/latency_bench
+
+CPPC ?= g++
+
+#
+# Rules
+#
+
+all: $(EXE) $(SWEEP) $(BENCH)
+
+$(CPPOBJ) $(ENTRYOBJ): | $(BUILDDIR)
+
+$(BUILDDIR):
+	@mkdir -p $(BUILDDIR)
+	@mkdir -p $(DEPDIR)
+	@mkdir -p $(OBJDIR)
+
+# The application entry point is invoked by the simulator and the benchmark, see host/simulator.cpp
+$(OBJDIR)/main.o: DEF += -Dmain=firmwareMain
+
+$(EXE): $(CPPOBJ) $(OBJDIR)/simulator.o
+	@echo
+	$(CPPC) $^ -o $@
+
+$(SWEEP): $(SWEEPOBJ) $(OBJDIR)/sweep.o
+	@echo
+	$(CPPC) $^ -o $@
+
+$(BENCH): $(CPPOBJ) $(OBJDIR)/latency_bench.o
+	@echo
+	$(CPPC) $^ -o $@
+
+$(CPPOBJ) $(ENTRYOBJ): $(OBJDIR)/%.o: %.cpp
+	@echo
+	$(CPPC) -c $(DEF) $(INC) $(CPPFLAGS) $< -o $@
+
+clean:
+	rm -rf $(BUILDDIR)
+
+.PHONY: all clean $(BUILDDIR)
+
+-include $(shell mkdir -p $(DEPDIR) 2>/dev/null) $(wildcard $(DEPDIR)/*)
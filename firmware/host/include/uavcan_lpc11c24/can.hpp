@@ -0,0 +1,93 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Host replacement for the CAN driver of the LPC11C24 libuavcan driver.
+ * This is an in-process virtual bus: frames transmitted by the node are handed over to the simulation,
+ * and frames injected by the simulation are received by the node. See host/sim.hpp.
+ */
+
+#pragma once
+
+#include <uavcan/driver/can.hpp>
+
+namespace uavcan_lpc11c24
+{
+
+class CanDriver : public uavcan::ICanDriver,
+                  public uavcan::ICanIface,
+                  uavcan::Noncopyable
+{
+    static CanDriver self;
+
+    static constexpr unsigned MaxFilters = 31;     ///< C_CAN of LPC11C24 has 32 message objects, one is for TX
+
+    bool had_activity_ = false;
+    std::uint64_t error_count_ = 0;
+
+    uavcan::CanFilterConfig filters_[MaxFilters];
+    unsigned num_filters_ = 0;                      ///< Everything is accepted until the filters are configured
+    std::uint64_t num_frames_accepted_ = 0;
+    std::uint64_t num_frames_rejected_ = 0;
+
+    bool isAcceptedByFilters(const uavcan::CanFrame& frame) const;
+
+    CanDriver() { }
+
+public:
+    static CanDriver& instance() { return self; }
+
+    /**
+     * The virtual bus does not need bit rate detection; the configured bit rate is returned immediately.
+     */
+    static uavcan::uint32_t detectBitRate(void (*idle_callback)() = nullptr);
+
+    int init(uavcan::uint32_t bitrate);
+
+    bool hadActivity();
+
+    /**
+     * Frames that have passed the acceptance filters and reached libuavcan, and frames dropped by the filters.
+     */
+    std::uint64_t getNumFramesAccepted() const { return num_frames_accepted_; }
+    std::uint64_t getNumFramesRejected() const { return num_frames_rejected_; }
+
+    virtual uavcan::int16_t send(const uavcan::CanFrame& frame,
+                                 uavcan::MonotonicTime tx_deadline,
+                                 uavcan::CanIOFlags flags);
+
+    virtual uavcan::int16_t receive(uavcan::CanFrame& out_frame,
+                                    uavcan::MonotonicTime& out_ts_monotonic,
+                                    uavcan::UtcTime& out_ts_utc,
+                                    uavcan::CanIOFlags& out_flags);
+
+    virtual uavcan::int16_t select(uavcan::CanSelectMasks& inout_masks,
+                                   const uavcan::CanFrame* (& pending_tx)[uavcan::MaxCanIfaces],
+                                   uavcan::MonotonicTime blocking_deadline);
+
+    virtual uavcan::int16_t configureFilters(const uavcan::CanFilterConfig* filter_configs,
+                                             uavcan::uint16_t num_configs);
+
+    virtual uavcan::uint64_t getErrorCount() const { return error_count_; }
+
+    virtual uavcan::uint16_t getNumFilters() const;
+
+    virtual uavcan::ICanIface* getIface(uavcan::uint8_t iface_index);
+
+    virtual uavcan::uint8_t getNumIfaces() const { return 1; }
+};
+
+}
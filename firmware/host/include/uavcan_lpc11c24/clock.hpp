@@ -0,0 +1,54 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Host replacement for the clock API of the LPC11C24 libuavcan driver.
+ * The time is virtual, see host/sim.hpp.
+ */
+
+#pragma once
+
+#include <uavcan/driver/system_clock.hpp>
+
+namespace uavcan_lpc11c24
+{
+namespace clock
+{
+
+void init();
+
+uavcan::MonotonicTime getMonotonic();
+
+uavcan::UtcTime getUtc();
+
+void adjustUtc(uavcan::UtcDuration adjustment);
+
+}
+
+class SystemClock : public uavcan::ISystemClock, uavcan::Noncopyable
+{
+    SystemClock() { }
+
+    virtual void adjustUtc(uavcan::UtcDuration adjustment) { clock::adjustUtc(adjustment); }
+
+public:
+    virtual uavcan::MonotonicTime getMonotonic() const { return clock::getMonotonic(); }
+    virtual uavcan::UtcTime getUtc()             const { return clock::getUtc(); }
+
+    static SystemClock& instance();
+};
+
+}
@@ -0,0 +1,468 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Command-to-actuation latency benchmark.
+ * Runs the unmodified application from src/main.cpp and sends it uavcan.equipment.hardpoint.Command messages
+ * over the virtual CAN bus, alternating between turn on and turn off, for every supply voltage in the range of
+ * the build variant. Each command is timestamped along the whole path:
+ *
+ *   rx      - the frame is read from the CAN driver by libuavcan
+ *   accept  - the command has been handled by magnet::handleCommand(); with HARDPOINT_FAST_PATH, this is usually
+ *             before rx, since the command is latched when the frame arrives
+ *   pump    - the first charger pump burst has started
+ *   fire    - the first thyristor pulse, i.e. the magnet is switched (for turn off, this is the release)
+ *   done    - the last thyristor pulse of the operation
+ *   confirm - the first uavcan.equipment.hardpoint.Status reporting the new state of the magnet has been sent
+ *
+ * All latencies are measured from the moment the frame is placed on the bus, and printed as CSV percentiles
+ * per supply voltage, command and stage. The commands are injected with a random (but seeded, hence
+ * reproducible) phase relative to the periodic activities of the firmware.
+ *
+ * The firmware sleeps between the commands, so the latencies include the wake-up; the frame wakes the core at
+ * once, and the pump waits for the ADC filter to be refilled, see board::sleepUntilInterrupt(). The share of
+ * time spent sleeping and the estimated average MCU current over the whole run are printed at the end.
+ */
+
+#include "sim.hpp"
+#include <magnet/magnet.hpp>
+#include <magnet/charger.hpp>
+#include <build_config.hpp>
+#include <uavcan/equipment/hardpoint/Command.hpp>
+#include <uavcan/equipment/hardpoint/Status.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <getopt.h>
+
+/**
+ * The application entry point, renamed by the host makefile.
+ */
+int firmwareMain();
+
+namespace
+{
+
+constexpr std::uint8_t SwitchingStatusMask = 3U << charger::Charger::ErrorFlagsBitLength;
+
+/**
+ * Hardpoint ID 0 with the node ID derived from it, so that the node does not wait for dynamic allocation.
+ */
+constexpr std::uint8_t DipSwitchFixedNodeID = 1U << (board::DipSwitchBits - 1);
+
+constexpr std::uint8_t SourceNodeID = 10;
+
+/**
+ * Time allowed for the node to start before the first command.
+ */
+constexpr std::uint64_t StartupUSec = 2000000;
+
+/**
+ * If the magnet does not start switching within this interval after reception, the command is considered
+ * rejected, e.g. by the rate limiter.
+ */
+constexpr std::uint64_t AcceptTimeoutUSec = 100000;
+
+constexpr std::uint64_t OperationTimeoutUSec = 60000000;
+
+/**
+ * The status is published at least every 500 ms.
+ */
+constexpr std::uint64_t ConfirmTimeoutUSec = 2000000;
+
+struct Options
+{
+    unsigned step_mV = 200;
+    unsigned samples = 20;
+    unsigned on_command = magnet::MinTurnOnCycles;
+    unsigned pause_ms = 5000;
+    unsigned jitter_ms = 500;
+};
+
+Options options;
+
+enum Stage
+{
+    StageRx,
+    StageAccept,
+    StagePump,
+    StageFire,
+    StageDone,
+    StageConfirm,
+    NumStages
+};
+
+const char* const StageNames[NumStages] = { "rx", "accept", "pump", "fire", "done", "confirm" };
+
+struct Series
+{
+    std::vector<std::uint64_t> latencies_usec[NumStages];
+    unsigned rejected = 0;
+};
+
+/**
+ * Builds a single frame transfer of uavcan.equipment.hardpoint.Command.
+ */
+uavcan::CanFrame makeCommandFrame(std::uint16_t command, std::uint8_t transfer_id)
+{
+    static constexpr unsigned Priority = 16;
+    static constexpr std::uint8_t HardpointID = 0;
+
+    const std::uint32_t id = (Priority << 24) |
+                             (unsigned(uavcan::equipment::hardpoint::Command::DefaultDataTypeID) << 8) |
+                             SourceNodeID;
+
+    const std::uint8_t data[] =
+    {
+        HardpointID,
+        std::uint8_t(command & 0xFFU),
+        std::uint8_t(command >> 8),
+        std::uint8_t(0xC0U | (transfer_id & 0x1FU))         // Start of transfer, end of transfer, toggle 0
+    };
+
+    return uavcan::CanFrame(id | uavcan::CanFrame::FlagEFF, data, sizeof(data));
+}
+
+/**
+ * Whether the frame is a single frame transfer of uavcan.equipment.hardpoint.Status with the given status value.
+ */
+bool isStatusFrame(const uavcan::CanFrame& frame, std::uint16_t status)
+{
+    // Hardpoint ID, payload weight (float16), its variance (float16), status (LE16), tail byte
+    static constexpr unsigned FrameLength = 8;
+
+    return frame.isExtended() && ((frame.id & 0x80U) == 0) &&
+           (((frame.id >> 8) & 0xFFFFU) == unsigned(uavcan::equipment::hardpoint::Status::DefaultDataTypeID)) &&
+           (frame.dlc == FrameLength) && ((frame.data[5] | (frame.data[6] << 8)) == status);
+}
+
+bool isSwitching()
+{
+    return (magnet::getStatusFlags() & SwitchingStatusMask) != 0;
+}
+
+/**
+ * Drives the scenario from the simulated board calls, since the application never returns.
+ */
+class Benchmark : public sim::IListener
+{
+    enum class State
+    {
+        Waiting,
+        Receiving,
+        Accepting,
+        Switching,
+        Confirming
+    };
+
+    State state_ = State::Waiting;
+    std::uint64_t next_command_at_usec_ = StartupUSec;
+    std::uint64_t injected_at_usec_ = 0;
+    std::uint64_t timestamps_[NumStages] = {};
+    bool turn_on_ = true;
+    std::uint8_t transfer_id_ = 0;
+
+    unsigned vin_mV_ = build_config::VinMin_mV;
+    unsigned sample_index_ = 0;
+
+    std::minstd_rand rng_;
+
+    void record(Stage stage)
+    {
+        if (timestamps_[stage] == 0)
+        {
+            timestamps_[stage] = sim::getTimeUSec();
+        }
+    }
+
+    void inject()
+    {
+        std::fill(std::begin(timestamps_), std::end(timestamps_), 0);
+        injected_at_usec_ = sim::getTimeUSec();
+        sim::injectCanFrame(makeCommandFrame(std::uint16_t(turn_on_ ? options.on_command : 0), transfer_id_++));
+        state_ = State::Receiving;
+    }
+
+    void finish(bool accepted);
+
+    void onLoopIteration() override
+    {
+        const auto now = sim::getTimeUSec();
+
+        switch (state_)
+        {
+        case State::Waiting:
+        {
+            if (now >= next_command_at_usec_)
+            {
+                inject();
+            }
+            break;
+        }
+        case State::Receiving:
+        {
+            if (isSwitching())                              // Accepted by the fast path
+            {
+                record(StageAccept);
+                state_ = State::Switching;
+            }
+            else if (now - injected_at_usec_ > OperationTimeoutUSec)
+            {
+                std::fprintf(stderr, "The command frame was not received\n");
+                std::exit(1);
+            }
+            break;
+        }
+        case State::Accepting:
+        {
+            if (isSwitching())
+            {
+                record(StageAccept);
+                state_ = State::Switching;
+            }
+            else if (now - timestamps_[StageRx] > AcceptTimeoutUSec)
+            {
+                finish(false);
+            }
+            break;
+        }
+        case State::Switching:
+        {
+            if (!isSwitching())
+            {
+                if (timestamps_[StageConfirm] != 0)
+                {
+                    finish(true);
+                }
+                else
+                {
+                    state_ = State::Confirming;
+                }
+            }
+            else if (now - injected_at_usec_ > OperationTimeoutUSec)
+            {
+                std::fprintf(stderr, "The operation did not complete\n");
+                std::exit(1);
+            }
+            break;
+        }
+        case State::Confirming:
+        {
+            if (now - timestamps_[StageDone] > ConfirmTimeoutUSec)
+            {
+                std::fprintf(stderr, "The new state was not reported\n");
+                std::exit(1);
+            }
+            break;
+        }
+        }
+    }
+
+    void onCanFrameTransmitted(const uavcan::CanFrame& frame) override
+    {
+        if (((state_ == State::Switching) || (state_ == State::Confirming)) && (timestamps_[StageFire] != 0) &&
+            isStatusFrame(frame, turn_on_ ? 1 : 0))
+        {
+            record(StageConfirm);
+            if (state_ == State::Confirming)
+            {
+                finish(true);
+            }
+        }
+    }
+
+    void onCanFrameReceived(const uavcan::CanFrame&) override
+    {
+        if (state_ == State::Receiving)
+        {
+            record(StageRx);
+            state_ = State::Accepting;
+        }
+        else if (state_ == State::Switching)
+        {
+            record(StageRx);
+        }
+        else
+        {
+            ;
+        }
+    }
+
+    void onPumpBurst(unsigned, std::uint64_t duration_usec, double) override
+    {
+        // The fast path may start the burst before the loop iteration that would notice the acceptance
+        if ((state_ == State::Receiving) && isSwitching())
+        {
+            timestamps_[StageAccept] = sim::getTimeUSec() - duration_usec;
+            state_ = State::Switching;
+        }
+
+        if ((state_ == State::Accepting) || (state_ == State::Switching))
+        {
+            // Reported on completion of the burst
+            if (timestamps_[StagePump] == 0)
+            {
+                timestamps_[StagePump] = sim::getTimeUSec() - duration_usec;
+            }
+        }
+    }
+
+    void onMagnetSwitched(bool, unsigned) override
+    {
+        if ((state_ == State::Accepting) || (state_ == State::Switching))
+        {
+            record(StageFire);
+            timestamps_[StageDone] = sim::getTimeUSec();
+        }
+    }
+
+public:
+    Series series[2];       ///< Turn off, turn on
+
+    void printHeader() const
+    {
+        std::printf("vin_mV,command,stage,samples,rejected,min_ms,p50_ms,p90_ms,p99_ms,max_ms\n");
+    }
+
+    void printSeries(unsigned vin_mV, bool turn_on)
+    {
+        auto& s = series[turn_on ? 1 : 0];
+
+        for (unsigned i = 0; i < NumStages; i++)
+        {
+            auto& v = s.latencies_usec[i];
+            std::sort(v.begin(), v.end());
+
+            const auto percentile = [&v](unsigned p)
+            {
+                if (v.empty())
+                {
+                    return 0.0;
+                }
+                const std::size_t rank = (v.size() * p + 99) / 100;
+                return double(v.at(std::max<std::size_t>(rank, 1) - 1)) * 1e-3;
+            };
+
+            std::printf("%u,%s,%s,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                        vin_mV, turn_on ? "on" : "off", StageNames[i], unsigned(v.size()), s.rejected,
+                        percentile(0), percentile(50), percentile(90), percentile(99), percentile(100));
+            v.clear();
+        }
+        s.rejected = 0;
+    }
+
+    void start()
+    {
+        sim::getEnvironment().supply_voltage_mV = vin_mV_;
+        printHeader();
+    }
+};
+
+Benchmark benchmark;
+
+void Benchmark::finish(bool accepted)
+{
+    auto& s = series[turn_on_ ? 1 : 0];
+
+    if (accepted)
+    {
+        for (unsigned i = 0; i < NumStages; i++)
+        {
+            s.latencies_usec[i].push_back(timestamps_[i] - injected_at_usec_);
+        }
+    }
+    else
+    {
+        s.rejected++;
+    }
+
+    turn_on_ = !turn_on_;
+    if (turn_on_)
+    {
+        sample_index_++;
+    }
+
+    if (sample_index_ >= options.samples)
+    {
+        printSeries(vin_mV_, true);
+        printSeries(vin_mV_, false);
+        std::fflush(stdout);
+
+        sample_index_ = 0;
+        vin_mV_ += options.step_mV;
+        if (vin_mV_ > build_config::VinMax_mV)
+        {
+            const double sleep_share = double(sim::getSleepTimeUSec()) / double(sim::getTimeUSec());
+            std::printf("# mcu_sleep_share=%.3f mcu_current_mA_est=%.2f\n",
+                        sleep_share, sim::estimateMcuCurrent(sleep_share) * 1e3);
+            std::exit(0);
+        }
+        sim::getEnvironment().supply_voltage_mV = vin_mV_;
+    }
+
+    // The pause lets the duty cycle limiter of the magnet recover; the jitter varies the phase of the command
+    const auto jitter_usec = (options.jitter_ms > 0) ? (rng_() % (options.jitter_ms * 1000ULL)) : 0;
+    next_command_at_usec_ = sim::getTimeUSec() + options.pause_ms * 1000ULL + jitter_usec;
+    state_ = State::Waiting;
+}
+
+void printUsage(const char* name)
+{
+    std::printf("Usage: %s [options]\n"
+                "  -s STEP_MV     supply voltage step, default 200\n"
+                "  -n SAMPLES     commands of each type per supply voltage, default 20\n"
+                "  -c COMMAND     command value for turn on, default %u\n"
+                "  -p PAUSE_MS    pause between commands, default 5000\n"
+                "  -j JITTER_MS   maximum random extension of the pause, default 500\n",
+                name, unsigned(magnet::MinTurnOnCycles));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int opt = 0;
+    while ((opt = ::getopt(argc, argv, "s:n:c:p:j:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': options.step_mV = unsigned(std::atoi(optarg));       break;
+        case 'n': options.samples = unsigned(std::atoi(optarg));       break;
+        case 'c': options.on_command = unsigned(std::atoi(optarg));    break;
+        case 'p': options.pause_ms = unsigned(std::atoi(optarg));      break;
+        case 'j': options.jitter_ms = unsigned(std::atoi(optarg));     break;
+        default:
+        {
+            printUsage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+        }
+    }
+
+    if ((options.step_mV == 0) || (options.samples == 0) || (options.on_command == 0))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    sim::getEnvironment().dip_switch = DipSwitchFixedNodeID;
+    sim::addListener(benchmark);
+    benchmark.start();
+
+    return firmwareMain();
+}
@@ -0,0 +1,309 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "plant.hpp"
+#include "sim.hpp"
+#include <build_config.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace plant
+{
+namespace
+{
+
+Parameters params = Parameters::forBuildVariant();
+
+Counters counters;
+
+double supply_voltage_V = 5.0;
+bool thyristor_failed = false;
+
+double state_time_s;                ///< Time at which the state below was last updated
+double output_voltage_V;
+double adc_output_voltage_V;        ///< Filtered
+double supply_droop_V;              ///< At the end of the last burst
+double last_burst_end_s;
+
+double getNow()
+{
+    return double(sim::getTimeUSec()) * 1e-6;
+}
+
+/**
+ * Brings the state up to the current virtual time: leakage and ADC filter response while not pumping.
+ */
+void settle()
+{
+    const double dt = getNow() - state_time_s;
+    if (dt <= 0.0)
+    {
+        return;
+    }
+    state_time_s += dt;
+
+    output_voltage_V *= std::exp(-dt / (params.leakage_resistance_Ohm * params.capacitance_F));
+    adc_output_voltage_V = output_voltage_V +
+                           (adc_output_voltage_V - output_voltage_V) * std::exp(-dt / params.adc_time_constant_s);
+}
+
+/**
+ * First order RL response: current and integral of current after the interval.
+ */
+void integrateRL(double voltage, double inductance, double duration, double& inout_current, double& out_charge)
+{
+    const double r = params.source_resistance_Ohm;
+    const double i_inf = voltage / r;
+    const double tau = inductance / r;
+    const double decay = std::exp(-duration / tau);
+
+    out_charge = i_inf * duration + (inout_current - i_inf) * tau * (1.0 - decay);
+    inout_current = i_inf + (inout_current - i_inf) * decay;
+}
+
+/**
+ * Time needed to bring the current from i0 to i1 < V/R through the specified inductance.
+ */
+double getRLTime(double voltage, double inductance, double i0, double i1)
+{
+    const double r = params.source_resistance_Ohm;
+    const double i_inf = voltage / r;
+    if (i1 >= i_inf)
+    {
+        return INFINITY;
+    }
+    return -(inductance / r) * std::log((i_inf - i1) / (i_inf - i0));
+}
+
+/**
+ * On phase; returns the input energy.
+ */
+double runOnPhase(double on_time_s, double& inout_current)
+{
+    double remaining = on_time_s;
+    double charge = 0.0;
+    double segment_charge = 0.0;
+
+    if (inout_current < params.saturation_current_A)
+    {
+        const double t = std::min(remaining, getRLTime(supply_voltage_V, params.primary_inductance_H,
+                                                       inout_current, params.saturation_current_A));
+        integrateRL(supply_voltage_V, params.primary_inductance_H, t, inout_current, segment_charge);
+        charge += segment_charge;
+        remaining -= t;
+    }
+
+    if (remaining > 0.0)
+    {
+        integrateRL(supply_voltage_V, params.saturated_inductance_H, remaining, inout_current, segment_charge);
+        charge += segment_charge;
+    }
+
+    return supply_voltage_V * charge;
+}
+
+/**
+ * Off phase; the secondary current charges the capacitor. The current is zero if the core has demagnetized.
+ */
+void runOffPhase(double off_time_s, double& inout_current)
+{
+    const double reflected_voltage = (output_voltage_V + params.diode_drop_V) / params.turns_ratio;
+
+    double remaining = off_time_s;
+    double primary_charge = 0.0;
+
+    if (inout_current > params.saturation_current_A)
+    {
+        const double i0 = inout_current;
+        const double t = std::min(remaining, (i0 - params.saturation_current_A) * params.saturated_inductance_H /
+                                             reflected_voltage);
+        inout_current = i0 - reflected_voltage * t / params.saturated_inductance_H;
+        primary_charge += 0.5 * (i0 + inout_current) * t;
+        remaining -= t;
+    }
+
+    if (remaining > 0.0)
+    {
+        const double i0 = inout_current;
+        const double t = std::min(remaining, i0 * params.primary_inductance_H / reflected_voltage);
+        inout_current = std::max(0.0, i0 - reflected_voltage * t / params.primary_inductance_H);
+        primary_charge += 0.5 * (i0 + inout_current) * t;
+    }
+
+    output_voltage_V += primary_charge / params.turns_ratio / params.capacitance_F;
+}
+
+}
+
+Parameters Parameters::forBuildVariant()
+{
+    Parameters p;
+
+    p.primary_inductance_H          = build_config::PRInductance_pH * 1e-12;
+    p.saturation_current_A          = 1.6;
+    p.saturated_inductance_H        = p.primary_inductance_H * 0.3;
+    p.turns_ratio                   = 10.0;
+    p.source_resistance_Ohm         = 0.35;
+    p.diode_drop_V                  = 1.0;
+    p.capacitance_F                 = 2.5e-6;           // Stored energy is Vout^2 * 1.25 uJ, see charger.cpp
+    p.esr_Ohm                       = 0.5;
+    p.leakage_resistance_Ohm        = 10e6;
+    p.winding_resistance_Ohm        = 2.0;
+    p.thyristor_residual_V          = 2.0;
+    p.adc_time_constant_s           = 0.5e-3;
+    p.supply_recovery_time_s        = 0.2e-3;
+
+#if defined(PRODROPPER) && PRODROPPER
+    // Higher supply voltage, so the supply current is lower for the same power
+    p.source_resistance_Ohm         = 0.5;
+#endif
+
+    return p;
+}
+
+void setParameters(const Parameters& p)
+{
+    params = p;
+}
+
+const Parameters& getParameters()
+{
+    return params;
+}
+
+void setSupplyVoltage(double volts)
+{
+    supply_voltage_V = volts;
+}
+
+BurstResult runPump(unsigned iterations, double on_time_s, double off_time_s,
+                    double stop_voltage_V, double sample_interval_s)
+{
+    settle();
+
+    BurstResult res;
+
+    const double period = on_time_s + off_time_s;
+    const double adc_alpha = 1.0 - std::exp(-period / params.adc_time_constant_s);
+
+    double current = 0.0;
+    double since_sample_s = 0.0;
+
+    while (res.iterations < iterations)
+    {
+        res.iterations++;
+
+        res.input_energy_J += runOnPhase(on_time_s, current);
+        res.peak_current_A = std::max(res.peak_current_A, current);
+
+        runOffPhase(off_time_s, current);
+
+        if (current > 0.0)
+        {
+            res.continuous_conduction_iterations++;
+        }
+
+        adc_output_voltage_V += (output_voltage_V - adc_output_voltage_V) * adc_alpha;
+
+        since_sample_s += period;
+        if (since_sample_s >= sample_interval_s)
+        {
+            since_sample_s = 0.0;
+            if (adc_output_voltage_V >= stop_voltage_V)
+            {
+                break;
+            }
+        }
+    }
+
+    // Whatever is left in the core at the end of the burst eventually ends up in the capacitor
+    runOffPhase(INFINITY, current);
+
+    res.duration_s = period * res.iterations;
+    output_voltage_V *= std::exp(-res.duration_s / (params.leakage_resistance_Ohm * params.capacitance_F));
+
+    state_time_s += res.duration_s;
+    last_burst_end_s = state_time_s;
+    supply_droop_V = (res.duration_s > 0.0) ?
+                     (res.input_energy_J / (supply_voltage_V * res.duration_s)) * params.source_resistance_Ohm : 0.0;
+
+    counters.input_energy_J += res.input_energy_J;
+    counters.peak_current_A = std::max(counters.peak_current_A, res.peak_current_A);
+    counters.iterations += res.iterations;
+    counters.continuous_conduction_iterations += res.continuous_conduction_iterations;
+
+    return res;
+}
+
+double fireThyristors()
+{
+    settle();
+
+    if (thyristor_failed || (output_voltage_V <= params.thyristor_residual_V))
+    {
+        return 0.0;
+    }
+
+    const double stored = 0.5 * params.capacitance_F *
+                          (output_voltage_V * output_voltage_V -
+                           params.thyristor_residual_V * params.thyristor_residual_V);
+    const double delivered = stored * params.winding_resistance_Ohm / (params.winding_resistance_Ohm + params.esr_Ohm);
+
+    output_voltage_V = params.thyristor_residual_V;
+    counters.discharged_energy_J += delivered;
+    return delivered;
+}
+
+void setThyristorFailure(bool failed)
+{
+    thyristor_failed = failed;
+}
+
+double getOutputVoltage()
+{
+    settle();
+    return output_voltage_V;
+}
+
+double getMeasuredOutputVoltage()
+{
+    settle();
+    return adc_output_voltage_V;
+}
+
+double getMeasuredSupplyVoltage()
+{
+    settle();
+    const double since_burst = state_time_s - last_burst_end_s;
+    return supply_voltage_V - supply_droop_V * std::exp(-since_burst / params.supply_recovery_time_s);
+}
+
+void reset()
+{
+    settle();
+    output_voltage_V = 0.0;
+    adc_output_voltage_V = 0.0;
+    supply_droop_V = 0.0;
+}
+
+Counters& getCounters()
+{
+    return counters;
+}
+
+}
@@ -0,0 +1,120 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Model of the power stage behind board::startPump(): supply with source impedance, flyback transformer with
+ * saturating core, storage capacitor with ESR and leakage, thyristor discharge into the magnet winding, and the
+ * RC filters in front of the ADC inputs.
+ * Currents are referred to the primary side of the transformer.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace plant
+{
+/**
+ * Parameters of a hardware variant.
+ */
+struct Parameters
+{
+    double primary_inductance_H;            ///< Unsaturated, build_config::PRInductance_pH
+    double saturation_current_A;            ///< Primary current where the core starts to saturate
+    double saturated_inductance_H;          ///< Differential inductance above the saturation current
+    double turns_ratio;                     ///< Secondary to primary
+    double source_resistance_Ohm;           ///< Supply wiring, fuse F1, switch on-resistance
+    double diode_drop_V;                    ///< Output rectifier
+    double capacitance_F;                   ///< Storage capacitor
+    double esr_Ohm;                         ///< Storage capacitor ESR
+    double leakage_resistance_Ohm;          ///< Capacitor leakage in parallel with the Vout divider
+    double winding_resistance_Ohm;          ///< Magnet winding, for the discharge energy split
+    double thyristor_residual_V;            ///< Voltage left on the capacitor once the thyristor stops conducting
+    double adc_time_constant_s;             ///< RC filter on the Vout ADC input
+    double supply_recovery_time_s;          ///< Supply droop recovery after a pump burst
+
+    /**
+     * Parameters of the variant selected at build time (PRODROPPER or OpenGrab EPM V3).
+     */
+    static Parameters forBuildVariant();
+};
+
+/**
+ * Outcome of a single pump burst.
+ */
+struct BurstResult
+{
+    unsigned iterations = 0;                            ///< Less than requested if the burst was stopped early
+    double duration_s = 0.0;
+    double input_energy_J = 0.0;
+    double peak_current_A = 0.0;
+    unsigned continuous_conduction_iterations = 0;      ///< The core did not demagnetize during the off time
+};
+
+/**
+ * Cumulative counters, can be reset by the user.
+ */
+struct Counters
+{
+    double input_energy_J = 0.0;
+    double discharged_energy_J = 0.0;
+    double peak_current_A = 0.0;
+    std::uint64_t iterations = 0;
+    std::uint64_t continuous_conduction_iterations = 0;
+};
+
+void setParameters(const Parameters& params);
+const Parameters& getParameters();
+
+void setSupplyVoltage(double volts);
+
+/**
+ * Runs the specified number of switching periods. The virtual time is not advanced here.
+ * If the measured output voltage, sampled every sample_interval_s, reaches stop_voltage_V, the burst is stopped
+ * at the end of the current period, like board::setPumpStopVoltage() does on the hardware.
+ */
+BurstResult runPump(unsigned iterations, double on_time_s, double off_time_s,
+                    double stop_voltage_V = INFINITY, double sample_interval_s = 0.0);
+
+/**
+ * Fires the thyristors, dumping the capacitor into the magnet winding.
+ * If the thyristor failure is being simulated, the capacitor is not discharged.
+ * @return Energy delivered to the winding.
+ */
+double fireThyristors();
+
+void setThyristorFailure(bool failed);
+
+/**
+ * Actual capacitor voltage.
+ */
+double getOutputVoltage();
+
+/**
+ * Voltages as seen by the ADC inputs, i.e. after the input filters.
+ */
+double getMeasuredOutputVoltage();
+double getMeasuredSupplyVoltage();
+
+/**
+ * Discharges the capacitor and clears the filter states, but keeps the counters.
+ */
+void reset();
+
+Counters& getCounters();
+
+}
@@ -0,0 +1,147 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.hpp"
+#include <cstdlib>
+#include <deque>
+#include <limits>
+
+namespace sim
+{
+namespace
+{
+
+std::uint64_t time_usec;
+std::uint64_t sleep_time_usec;
+
+Environment environment;
+
+std::vector<IListener*> listeners;
+
+std::deque<uavcan::CanFrame> injected_can_frames;
+
+void (*can_rx_interrupt_handler)(const uavcan::CanFrame&) = nullptr;
+
+std::uint64_t time_limit_usec = std::numeric_limits<std::uint64_t>::max();
+
+void (*exit_callback)() = nullptr;
+
+}
+
+std::uint64_t getTimeUSec()
+{
+    return time_usec;
+}
+
+void advanceTime(std::uint64_t usec)
+{
+    time_usec += usec;
+}
+
+void sleep(std::uint64_t max_usec)
+{
+    if (!injected_can_frames.empty() || (environment.pending_button_presses > 0))
+    {
+        return;
+    }
+    time_usec += max_usec;
+    sleep_time_usec += max_usec;
+}
+
+std::uint64_t getSleepTimeUSec()
+{
+    return sleep_time_usec;
+}
+
+double estimateMcuCurrent(double sleep_share)
+{
+    return McuActiveCurrentA * (1.0 - sleep_share) + McuSleepCurrentA * sleep_share;
+}
+
+Environment& getEnvironment()
+{
+    return environment;
+}
+
+void addListener(IListener& listener)
+{
+    listeners.push_back(&listener);
+}
+
+const std::vector<IListener*>& getListeners()
+{
+    return listeners;
+}
+
+void injectCanFrame(const uavcan::CanFrame& frame)
+{
+    injected_can_frames.push_back(frame);
+
+    if (can_rx_interrupt_handler != nullptr)
+    {
+        can_rx_interrupt_handler(frame);
+    }
+}
+
+unsigned getNumInjectedCanFrames()
+{
+    return static_cast<unsigned>(injected_can_frames.size());
+}
+
+void setCanRxInterruptHandler(void (*handler)(const uavcan::CanFrame&))
+{
+    can_rx_interrupt_handler = handler;
+}
+
+bool popInjectedCanFrame(uavcan::CanFrame& out_frame)
+{
+    if (injected_can_frames.empty())
+    {
+        return false;
+    }
+    out_frame = injected_can_frames.front();
+    injected_can_frames.pop_front();
+    return true;
+}
+
+void setTimeLimit(std::uint64_t usec, void (*on_exit)())
+{
+    time_limit_usec = usec;
+    exit_callback = on_exit;
+}
+
+void handleLoopIteration()
+{
+    advanceTime(MainLoopIterationUSec);
+
+    for (auto l : listeners)
+    {
+        l->onLoopIteration();
+    }
+
+    if (time_usec >= time_limit_usec)
+    {
+        if (exit_callback != nullptr)
+        {
+            exit_callback();
+        }
+        std::exit(0);
+    }
+}
+
+}
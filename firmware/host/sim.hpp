@@ -0,0 +1,158 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Simulated environment of the host build.
+ * The host build links the application (src/main.cpp, src/magnet/) against a simulated implementation of
+ * src/sys/board.hpp and of the LPC11C24 libuavcan driver, so the magnet and charger logic can be exercised
+ * on a workstation faster than real time.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sys/board.hpp>
+#include <uavcan/driver/can.hpp>
+
+namespace sim
+{
+/**
+ * Rough execution time estimates for the LPC11C24 at 48 MHz.
+ * They only define how fast the virtual time runs when the firmware is not blocked in a board call.
+ */
+static constexpr unsigned MainLoopIterationUSec = 20;       ///< spinOnce() and poll() with nothing to do
+static constexpr unsigned UartByteUSec          = 87;       ///< 10 bits at 115200 baud
+
+/**
+ * Rough supply current of the LPC11C24 at 48 MHz with the peripherals of the firmware running, from the typical
+ * figures of the datasheet. Only used to estimate the average current from the share of time spent sleeping.
+ */
+static constexpr double McuActiveCurrentA = 9e-3;
+static constexpr double McuSleepCurrentA  = 4e-3;
+
+/**
+ * Virtual time in microseconds since power up.
+ * It advances only when the firmware consumes time (busy loops, pump bursts, main loop iterations), so
+ * the simulated firmware runs as fast as the host can execute it.
+ */
+std::uint64_t getTimeUSec();
+
+/**
+ * Moves the virtual time forward. Used by the simulated board to account for the time spent in board calls.
+ */
+void advanceTime(std::uint64_t usec);
+
+/**
+ * Moves the virtual time forward while the core is sleeping, until the next interrupt or for at most the
+ * specified time. Returns at once if an interrupt is pending, i.e. a CAN frame or a button press is waiting.
+ */
+void sleep(std::uint64_t max_usec);
+
+/**
+ * Total time spent in sleep().
+ */
+std::uint64_t getSleepTimeUSec();
+
+/**
+ * Average MCU current in amperes for the given share of time spent sleeping, see McuActiveCurrentA.
+ */
+double estimateMcuCurrent(double sleep_share);
+
+/**
+ * Inputs of the simulated board.
+ */
+struct Environment
+{
+    unsigned supply_voltage_mV = 5000;
+    std::uint8_t dip_switch = 0;
+    board::PwmInput pwm_input = board::PwmInput::NoSignal;
+    unsigned pending_button_presses = 0;
+    bool echo_syslog = false;
+    board::PersistentConfig persistent_config;      ///< Contents of the flash, nothing is stored by default
+};
+
+Environment& getEnvironment();
+
+/**
+ * Events produced by the simulated hardware. Listeners are invoked synchronously from the board calls.
+ */
+class IListener
+{
+public:
+    virtual ~IListener() { }
+
+    virtual void onLoopIteration() { }
+
+    virtual void onPumpBurst(unsigned iterations, std::uint64_t duration_usec, double energy_J)
+    {
+        (void)iterations;
+        (void)duration_usec;
+        (void)energy_J;
+    }
+
+    virtual void onMagnetSwitched(bool positive, unsigned out_voltage_V)
+    {
+        (void)positive;
+        (void)out_voltage_V;
+    }
+
+    virtual void onCanFrameTransmitted(const uavcan::CanFrame& frame)
+    {
+        (void)frame;
+    }
+
+    /**
+     * Invoked when the node reads an injected frame from the driver.
+     */
+    virtual void onCanFrameReceived(const uavcan::CanFrame& frame)
+    {
+        (void)frame;
+    }
+};
+
+void addListener(IListener& listener);
+
+const std::vector<IListener*>& getListeners();
+
+/**
+ * Virtual CAN bus.
+ * Injected frames are delivered to the node in the order of injection.
+ */
+void injectCanFrame(const uavcan::CanFrame& frame);
+
+unsigned getNumInjectedCanFrames();
+
+bool popInjectedCanFrame(uavcan::CanFrame& out_frame);
+
+/**
+ * Called for every injected frame at the moment of injection, like the CAN interrupt of the target.
+ * The frame is still delivered to the node.
+ */
+void setCanRxInterruptHandler(void (*handler)(const uavcan::CanFrame&));
+
+/**
+ * The simulation terminates when the virtual time reaches the limit; the check is performed once per main loop
+ * iteration. The callback is invoked before exit, e.g. to print the report.
+ */
+void setTimeLimit(std::uint64_t usec, void (*on_exit)());
+
+/**
+ * Called by the simulated board once per main loop iteration.
+ */
+void handleLoopIteration();
+
+}
@@ -0,0 +1,202 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Entry point of the host build.
+ * Runs the unmodified application from src/main.cpp against the simulated board and prints a summary
+ * once the virtual time limit is reached.
+ */
+
+#include "sim.hpp"
+#include <uavcan_lpc11c24/can.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <getopt.h>
+
+/**
+ * The application entry point, renamed by the host makefile.
+ */
+int firmwareMain();
+
+namespace
+{
+
+struct Options
+{
+    double duration_sec = 10.0;
+    unsigned toggle_period_ms = 0;
+    unsigned bus_load_fps = 0;
+};
+
+Options options;
+
+const auto started_at = std::chrono::steady_clock::now();
+
+class Statistics : public sim::IListener
+{
+    std::uint64_t next_toggle_at_usec_ = 0;
+    std::uint64_t next_frame_at_usec_ = 0;
+    std::minstd_rand rng_;
+
+    /**
+     * Single frame message transfer of a random data type from a random node, the payload is only the tail byte.
+     */
+    uavcan::CanFrame makeBackgroundFrame()
+    {
+        static constexpr unsigned Priority = 24;
+
+        const unsigned data_type_id = rng_() % 0x10000U;
+        const unsigned source_node_id = 1U + rng_() % 127U;
+        const std::uint32_t id = (Priority << 24) | (data_type_id << 8) | source_node_id;
+        const std::uint8_t tail = std::uint8_t(0xC0U | (rng_() & 0x1FU));
+
+        return uavcan::CanFrame(id | uavcan::CanFrame::FlagEFF, &tail, 1);
+    }
+
+    void onLoopIteration() override
+    {
+        loop_iterations++;
+
+        if ((options.toggle_period_ms > 0) && (sim::getTimeUSec() >= next_toggle_at_usec_))
+        {
+            next_toggle_at_usec_ = sim::getTimeUSec() + options.toggle_period_ms * 1000ULL;
+            sim::getEnvironment().pending_button_presses++;
+        }
+
+        while ((options.bus_load_fps > 0) && (sim::getTimeUSec() >= next_frame_at_usec_))
+        {
+            next_frame_at_usec_ += 1000000U / options.bus_load_fps;
+            sim::injectCanFrame(makeBackgroundFrame());
+        }
+    }
+
+    void onPumpBurst(unsigned iterations, std::uint64_t duration_usec, double energy_J) override
+    {
+        pump_bursts++;
+        pump_iterations += iterations;
+        pump_time_usec += duration_usec;
+        pumped_energy_J += energy_J;
+    }
+
+    void onMagnetSwitched(bool positive, unsigned) override
+    {
+        (positive ? switches_pos : switches_neg)++;
+    }
+
+    void onCanFrameTransmitted(const uavcan::CanFrame&) override
+    {
+        can_frames_tx++;
+    }
+
+public:
+    std::uint64_t loop_iterations = 0;
+    std::uint64_t pump_bursts = 0;
+    std::uint64_t pump_iterations = 0;
+    std::uint64_t pump_time_usec = 0;
+    double pumped_energy_J = 0.0;
+    std::uint64_t switches_pos = 0;
+    std::uint64_t switches_neg = 0;
+    std::uint64_t can_frames_tx = 0;
+};
+
+Statistics statistics;
+
+void printReport()
+{
+    const double virtual_sec = double(sim::getTimeUSec()) * 1e-6;
+    const double real_sec =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+
+    std::printf("\n");
+    std::printf("Virtual time        %.3f s\n", virtual_sec);
+    std::printf("Real time           %.3f s (%.1fx real time)\n", real_sec, virtual_sec / real_sec);
+    std::printf("Main loop           %llu iterations, %.1f us average period\n",
+                static_cast<unsigned long long>(statistics.loop_iterations),
+                double(sim::getTimeUSec()) / double(std::max<std::uint64_t>(statistics.loop_iterations, 1)));
+    std::printf("Pump                %llu bursts, %llu iterations, %.3f s, %.3f J\n",
+                static_cast<unsigned long long>(statistics.pump_bursts),
+                static_cast<unsigned long long>(statistics.pump_iterations),
+                double(statistics.pump_time_usec) * 1e-6,
+                statistics.pumped_energy_J);
+    std::printf("Magnet switching    %llu positive, %llu negative\n",
+                static_cast<unsigned long long>(statistics.switches_pos),
+                static_cast<unsigned long long>(statistics.switches_neg));
+    std::printf("CAN frames sent     %llu\n", static_cast<unsigned long long>(statistics.can_frames_tx));
+    std::printf("CAN frames received %llu passed the acceptance filters, %llu rejected\n",
+                static_cast<unsigned long long>(uavcan_lpc11c24::CanDriver::instance().getNumFramesAccepted()),
+                static_cast<unsigned long long>(uavcan_lpc11c24::CanDriver::instance().getNumFramesRejected()));
+    const double sleep_share = double(sim::getSleepTimeUSec()) / double(std::max<std::uint64_t>(sim::getTimeUSec(), 1));
+    std::printf("MCU sleep           %.1f%% of the time, %.2f mA average current (estimate)\n",
+                sleep_share * 100.0, sim::estimateMcuCurrent(sleep_share) * 1e3);
+}
+
+void printUsage(const char* name)
+{
+    std::printf("Usage: %s [options]\n"
+                "  -d, --duration=SEC   virtual time to simulate, default 10\n"
+                "  -v, --vin=MV         supply voltage in millivolts, default 5000\n"
+                "  -s, --dip=N          DIP switch state, default 0 (dynamic node ID)\n"
+                "  -t, --toggle=MS      press the button every MS milliseconds of virtual time\n"
+                "  -b, --bus-load=FPS   background traffic of random message types, frames per second\n"
+                "  -l, --log            print the firmware syslog output\n",
+                name);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    static const ::option long_options[] =
+    {
+        { "duration", required_argument, nullptr, 'd' },
+        { "vin",      required_argument, nullptr, 'v' },
+        { "dip",      required_argument, nullptr, 's' },
+        { "toggle",   required_argument, nullptr, 't' },
+        { "bus-load", required_argument, nullptr, 'b' },
+        { "log",      no_argument,       nullptr, 'l' },
+        { "help",     no_argument,       nullptr, 'h' },
+        { nullptr,    0,                 nullptr, 0 }
+    };
+
+    auto& env = sim::getEnvironment();
+
+    int opt = 0;
+    while ((opt = ::getopt_long(argc, argv, "d:v:s:t:b:lh", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': options.duration_sec = std::atof(optarg);                                 break;
+        case 'v': env.supply_voltage_mV = unsigned(std::atoi(optarg));                      break;
+        case 's': env.dip_switch = static_cast<std::uint8_t>(std::atoi(optarg));            break;
+        case 't': options.toggle_period_ms = unsigned(std::atoi(optarg));                   break;
+        case 'b': options.bus_load_fps = unsigned(std::atoi(optarg));                       break;
+        case 'l': env.echo_syslog = true;                                                   break;
+        default:
+        {
+            printUsage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+        }
+    }
+
+    sim::addListener(statistics);
+    sim::setTimeLimit(static_cast<std::uint64_t>(options.duration_sec * 1e6), &printReport);
+
+    return firmwareMain();
+}
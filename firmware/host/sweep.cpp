@@ -0,0 +1,200 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Supply voltage sweep of the charger against the power stage model.
+ * For every supply voltage in the range of the build variant, the magnet is turned on and then off, and the
+ * charge time, energy and peak primary current of each operation are printed as CSV.
+ * The peak current and the share of switching periods in continuous conduction mode show whether the on/off
+ * time formulas of charger::Charger::runAndGetStatus() keep the transformer within its design limits.
+ */
+
+#include "sim.hpp"
+#include "plant.hpp"
+#include <magnet/magnet.hpp>
+#include <magnet/charger.hpp>
+#include <build_config.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+
+namespace
+{
+
+constexpr std::uint8_t SwitchingStatusMask = 3U << charger::Charger::ErrorFlagsBitLength;
+
+/**
+ * Long enough to let the duty cycle limiter of the magnet recover completely.
+ */
+constexpr std::uint64_t PauseBetweenOperationsUSec = 10000000;
+
+class FireCounter : public sim::IListener
+{
+    void onMagnetSwitched(bool, unsigned) override { count++; }
+
+public:
+    unsigned count = 0;
+};
+
+FireCounter fire_counter;
+
+struct OperationResult
+{
+    double duration_ms = 0.0;
+    double energy_J = 0.0;
+    double peak_current_A = 0.0;
+    double ccm_share = 0.0;
+    unsigned fires = 0;
+    bool failed = false;
+};
+
+void spin()
+{
+    magnet::poll();
+    board::resetWatchdog();     // Advances the virtual time by one main loop iteration
+
+    if (magnet::isIdle())
+    {
+        board::sleepUntilInterrupt();
+    }
+}
+
+void pause()
+{
+    const auto until = sim::getTimeUSec() + PauseBetweenOperationsUSec;
+    while (sim::getTimeUSec() < until)
+    {
+        spin();
+    }
+}
+
+template <typename Command>
+OperationResult measure(Command command)
+{
+    plant::getCounters() = plant::Counters();
+    fire_counter.count = 0;
+
+    const auto started_at = sim::getTimeUSec();
+
+    command();
+    do
+    {
+        spin();
+    }
+    while ((magnet::getStatusFlags() & SwitchingStatusMask) != 0);
+
+    const auto& cnt = plant::getCounters();
+
+    OperationResult res;
+    res.duration_ms = double(sim::getTimeUSec() - started_at) * 1e-3;
+    res.energy_J = cnt.input_energy_J;
+    res.peak_current_A = cnt.peak_current_A;
+    res.ccm_share = (cnt.iterations > 0) ? double(cnt.continuous_conduction_iterations) / double(cnt.iterations) : 0.0;
+    res.fires = fire_counter.count;
+    res.failed = magnet::getHealth() != magnet::Health::Ok;
+    return res;
+}
+
+struct IdleResult
+{
+    double power_W = 0.0;           ///< Drawn by the power stage, non-zero with the standby precharge
+    double mcu_current_A = 0.0;     ///< Estimated from the share of time the core is sleeping
+};
+
+IdleResult measureIdle()
+{
+    plant::getCounters() = plant::Counters();
+    const auto started_at = sim::getTimeUSec();
+    const auto slept_before = sim::getSleepTimeUSec();
+    pause();
+
+    const double duration_usec = double(sim::getTimeUSec() - started_at);
+    const double sleep_share = double(sim::getSleepTimeUSec() - slept_before) / duration_usec;
+
+    IdleResult res;
+    res.power_W = plant::getCounters().input_energy_J / (duration_usec * 1e-6);
+    res.mcu_current_A = sim::estimateMcuCurrent(sleep_share);
+    return res;
+}
+
+void printResult(const OperationResult& res)
+{
+    std::printf(",%.1f,%.4f,%u,%.2f,%.3f,%d",
+                res.duration_ms, res.energy_J, res.fires, res.peak_current_A, res.ccm_share, res.failed ? 1 : 0);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    unsigned step_mV = 100;
+    unsigned on_cycles = magnet::MinTurnOnCycles;
+    double inductance_factor = 1.0;
+
+    int opt = 0;
+    while ((opt = ::getopt(argc, argv, "s:c:k:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': step_mV = unsigned(std::atoi(optarg));    break;
+        case 'c': on_cycles = unsigned(std::atoi(optarg));  break;
+        case 'k': inductance_factor = std::atof(optarg);    break;
+        default:
+        {
+            std::printf("Usage: %s [-s STEP_MV] [-c TURN_ON_CYCLES] [-k INDUCTANCE_FACTOR]\n", argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+        }
+    }
+
+    {
+        // Manufacturing tolerance of the transformer
+        auto params = plant::getParameters();
+        params.primary_inductance_H *= inductance_factor;
+        params.saturated_inductance_H *= inductance_factor;
+        plant::setParameters(params);
+    }
+
+    sim::addListener(fire_counter);
+
+    std::printf("# saturation_current_A=%.2f\n", plant::getParameters().saturation_current_A);
+    std::printf("vin_mV,"
+                "on_ms,on_J,on_fires,on_peak_A,on_ccm_share,on_failed,"
+                "off_ms,off_J,off_fires,off_peak_A,off_ccm_share,off_failed,"
+                "idle_mW,idle_mcu_mA_est\n");
+
+    for (unsigned vin = build_config::VinMin_mV; vin <= build_config::VinMax_mV; vin += step_mV)
+    {
+        sim::getEnvironment().supply_voltage_mV = vin;
+        plant::reset();
+        pause();
+
+        const auto on = measure([on_cycles]() { magnet::turnOn(on_cycles); });
+        pause();
+
+        const auto off = measure([]() { magnet::turnOff(); });
+        pause();
+
+        const auto idle = measureIdle();
+
+        std::printf("%u", vin);
+        printResult(on);
+        printResult(off);
+        std::printf(",%.1f,%.2f\n", idle.power_W * 1e3, idle.mcu_current_A * 1e3);
+    }
+
+    return 0;
+}
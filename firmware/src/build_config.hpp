@@ -47,4 +47,34 @@ static constexpr int      cycles_to_skip                = 5;
 
 #endif
 
+/**
+ * The pump has four switches in parallel, but with PUMP_TIMER only three of them are driven: PIO1_0 has no match
+ * output of CT32B1, see board.cpp. The on time is scaled down by NumDrivenPumpSwitches / NumPumpSwitches, so that
+ * each driven switch carries no more than its design current at the cost of the charging power.
+ */
+static constexpr unsigned NumPumpSwitches = 4;
+#if defined(PUMP_TIMER) && PUMP_TIMER
+static constexpr unsigned NumDrivenPumpSwitches = 3;
+#else
+static constexpr unsigned NumDrivenPumpSwitches = 4;
+#endif
+
+/**
+ * Closed loop correction of the pump on/off times, see charger.cpp.
+ */
+#if defined(ADAPTIVE_PUMP_TIMING) && ADAPTIVE_PUMP_TIMING
+static constexpr bool AdaptivePumpTiming = true;
+#else
+static constexpr bool AdaptivePumpTiming = false;
+#endif
+
+/**
+ * The capacitor is kept charged for the first switching cycle while idle, see magnet.cpp.
+ */
+#if defined(STANDBY_PRECHARGE) && STANDBY_PRECHARGE
+static constexpr bool StandbyPrecharge = true;
+#else
+static constexpr bool StandbyPrecharge = false;
+#endif
+
 }
@@ -20,15 +20,304 @@
  */
 
 #include "charger.hpp"
+#include "magnet.hpp"
 #include <sys/board.hpp>
-#include <chip.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
 
 namespace charger
 {
+namespace
+{
+/**
+ * Pump on and off delays precomputed for every combination of quantized supply and output voltage, so that no
+ * divisions are needed at run time (Cortex-M0 has no hardware divider). Each entry holds the on time in the
+ * upper byte and the off time in the lower byte, in board::startPump() delay iterations.
+ *
+ * The entries are computed from the upper edge of the supply voltage bucket and from the lower edge of the output
+ * voltage bucket, so the quantization can only make the on time shorter and the off time longer, i.e. the peak
+ * current never exceeds the one computed for the exact voltages. The supply voltage step is the largest power of
+ * two that is under 4% of the lowest (VinMin - 500 mV), so the on time is never shortened by more than that.
+ */
+namespace pump_table
+{
+
+constexpr unsigned floorLog2(unsigned x) { return (x <= 1) ? 0 : (1 + floorLog2(x / 2)); }
+
+constexpr unsigned VinShift = floorLog2((build_config::VinMin_mV - 500) / 25);
+constexpr unsigned VoutShift = 4;                               ///< 16 V
+constexpr unsigned NumVinBuckets = ((build_config::VinMax_mV - build_config::VinMin_mV) >> VinShift) + 1;
+constexpr unsigned NumVoutBuckets = 32;                         ///< Everything above 496 V is in the last bucket
+
+constexpr unsigned MaxOffIterations = 120;                      ///< When the output voltage is really low off time is to long
+
+constexpr bool isReducedCurrent(unsigned vin_index)
+{
+    // Reduce current consumtion when Vin is low, compatiblity with crapy power rails like PixHawk or cell phone chargers
+    return (build_config::VinMin_mV + (vin_index << VinShift)) < build_config::ReducedCurrentVoltage_mV;
+}
+
+constexpr unsigned getOnTimeNs(unsigned vin_index)
+{
+    return (build_config::PRInductance_pH - (isReducedCurrent(vin_index) ? 3000000U : 0U)) /
+           (std::min(build_config::VinMin_mV + ((vin_index + 1) << VinShift) - 1, build_config::VinMax_mV) - 500);
+}
+
+constexpr unsigned getOffTimeNs(unsigned vin_index, unsigned vout_index)
+{
+    return (getOnTimeNs(vin_index) / ((vout_index << VoutShift) + 1)) * 50 + 1000;
+}
+
+constexpr unsigned getOffIterations(unsigned off_time_ns)
+{
+    return std::min((off_time_ns > 360) ? ((off_time_ns - board::PumpOffOverheadNs) / board::PumpIterationNs) : 1U,
+                    MaxOffIterations);
+}
+
+constexpr std::uint16_t makeEntry(unsigned index)
+{
+    return std::uint16_t((((getOnTimeNs(index / NumVoutBuckets) - board::PumpOnOverheadNs) /
+                           board::PumpIterationNs) << 8) |
+                         getOffIterations(getOffTimeNs(index / NumVoutBuckets, index % NumVoutBuckets)));
+}
+
+template <std::size_t... Indices>
+constexpr std::array<std::uint16_t, sizeof...(Indices)> makeTable(std::index_sequence<Indices...>)
+{
+    return {{ makeEntry(Indices)... }};
+}
+
+constexpr std::array<std::uint16_t, NumVinBuckets * NumVoutBuckets> Table =
+    makeTable(std::make_index_sequence<NumVinBuckets * NumVoutBuckets>());
+
+static_assert(MaxOffIterations < 256, "Off time does not fit the table entry");
+
+}
+
+/**
+ * The delays from pump_table are scaled at run time by the tuned inductance (params::Param::PRInductancePicohenries)
+ * relative to the default one, and by the correction of the adaptive pump timing; the product of both is kept
+ * within the safe bounds. TimingScaleOne is the unity.
+ */
+constexpr unsigned TimingScaleOne = 64;
+constexpr unsigned MinTimingScale = 48;             ///< Safe bounds of the correction, -25%..+25%
+constexpr unsigned MaxTimingScale = 80;
+
+/**
+ * The table is computed for build_config::ReducedCurrentVoltage_mV. If the tuned voltage puts a supply voltage
+ * bucket on the other side of it, the delays of the bucket are scaled by the ratio of the inductances that the on
+ * time is computed for, see pump_table::getOnTimeNs().
+ */
+constexpr unsigned ReducedCurrentInductance_pH = build_config::PRInductance_pH - 3000000U;
+constexpr unsigned ReducedCurrentScale =
+    (ReducedCurrentInductance_pH * TimingScaleOne + build_config::PRInductance_pH / 2) / build_config::PRInductance_pH;
+constexpr unsigned FullCurrentScale =
+    (build_config::PRInductance_pH * TimingScaleOne + ReducedCurrentInductance_pH / 2) / ReducedCurrentInductance_pH;
+
+bool isReducedCurrent(unsigned vin_index)
+{
+    return (build_config::VinMin_mV + (vin_index << pump_table::VinShift)) <
+           params::get(params::Param::ReducedCurrentVoltageMillivolts);
+}
+
+unsigned applyTimingScale(unsigned value, unsigned scale)
+{
+    return (value * scale + TimingScaleOne / 2) / TimingScaleOne;
+}
+
+/**
+ * Learns the inductance that maximizes the charging power of the unit, as a correction factor applied to
+ * the delays from pump_table. Both delays are proportional to build_config::PRInductance_pH (the off time is
+ * derived from the on time), so this scales the peak primary current while keeping the transformer demagnetized
+ * every period.
+ *
+ * The charging power is measured as the growth of Vout^2 per unit of time over a window of pump bursts.
+ * The factor is perturbed around its center value in the order +, -, -, +, which cancels out the linear growth
+ * of the power during the charge; then the center is moved one step towards the higher power.
+ * The result is kept between charges, so the correction converges over the first few operations after power up.
+ */
+class PumpTimingLearner
+{
+public:
+    static constexpr unsigned ScaleOne = TimingScaleOne;
+
+private:
+    static constexpr unsigned MinScale = MinTimingScale;
+    static constexpr unsigned MaxScale = MaxTimingScale;
+    static constexpr unsigned Perturbation = 3;         ///< About one pump delay iteration
+    static constexpr unsigned BurstsPerWindow = 8;
+    static constexpr unsigned NumPhases = 4;
+
+    unsigned center_ = ScaleOne;
+    unsigned phase_ = 0;
+    unsigned bursts_ = 0;
+    bool burst_pending_ = false;
+    std::int32_t gradient_ = 0;
+    std::int32_t total_ = 0;
+    std::uint32_t window_voltage_sq_ = 0;
+    board::MonotonicTime window_started_at_;
+
+    static bool isPositivePhase(unsigned phase) { return (phase == 0) || (phase == 3); }
+
+public:
+    /**
+     * The correction is not applied at low output voltage, where the off time is clamped and the transformer
+     * may not be fully demagnetized, so that the peak current there is not increased.
+     */
+    static constexpr unsigned MinOutputVoltage = 50;
+
+    unsigned getScale() const
+    {
+        return isPositivePhase(phase_) ? (center_ + Perturbation) : (center_ - Perturbation);
+    }
+
+    /**
+     * Discards the current window, e.g. when a new charge begins.
+     */
+    void restartWindow()
+    {
+        bursts_ = 0;
+        burst_pending_ = false;
+    }
+
+    /**
+     * Must be invoked when a pump burst is started with the current scale.
+     */
+    void beginBurst() { burst_pending_ = true; }
+
+    /**
+     * Must be invoked when the pump burst is finished; does nothing if the burst was not started with beginBurst().
+     */
+    void handleBurst(unsigned output_voltage)
+    {
+        if (!burst_pending_)
+        {
+            return;
+        }
+        burst_pending_ = false;
+
+        if (output_voltage < MinOutputVoltage)
+        {
+            restartWindow();
+            return;
+        }
+
+        const auto ts = board::clock::getMonotonic();
+        const auto voltage_sq = std::uint32_t(output_voltage * output_voltage);
+
+        if (bursts_ == 0)
+        {
+            window_started_at_ = ts;
+            window_voltage_sq_ = voltage_sq;
+        }
+
+        if (++bursts_ <= BurstsPerWindow)
+        {
+            return;
+        }
+        bursts_ = 0;
+
+        // V^2 per millisecond; the window is too short to overflow
+        const auto dt_usec = std::max<std::int32_t>(std::int32_t((ts - window_started_at_).toUSec()), 1);
+        const auto power = (std::int32_t(voltage_sq) - std::int32_t(window_voltage_sq_)) * 1000 / dt_usec;
+
+        gradient_ += isPositivePhase(phase_) ? power : -power;
+        total_ += power;
+
+        if (++phase_ < NumPhases)
+        {
+            return;
+        }
+        phase_ = 0;
+
+        // Dead band of about 3% of the average power, to not walk on noise
+        if (gradient_ * 32 > total_)
+        {
+            center_ = std::min(center_ + 1U, MaxScale - Perturbation);
+        }
+        else if (gradient_ * -32 > total_)
+        {
+            center_ = std::max(center_ - 1U, MinScale + Perturbation);
+        }
+
+        gradient_ = 0;
+        total_ = 0;
+    }
+};
+
+PumpTimingLearner pump_timing_learner;
+
+/**
+ * Pump iterations per burst, the output voltage is checked between the bursts.
+ */
+constexpr unsigned InitialBurstIterations = 50;
+constexpr unsigned MinBurstIterations = 4;
+constexpr unsigned MaxBurstIterations = 200;
+
+/**
+ * The busy loop pump blocks the main loop, so its bursts are shortened to fit in 80% of magnet::poll() time
+ * budget. The timer driven pump runs in the background.
+ */
+constexpr unsigned MaxBurstDurationNs = PUMP_TIMER ? 0xFFFFFFFFU : (magnet::MaxPollDurationUSec * 800U);
+
+}
 
 Charger::Charger(unsigned target_output_voltage) :
-    target_output_voltage_(target_output_voltage)
-{ }
+    target_output_voltage_(target_output_voltage),
+    timing_scale_((params::get(params::Param::PRInductancePicohenries) * TimingScaleOne +
+                   build_config::PRInductance_pH / 2) / build_config::PRInductance_pH),
+    burst_iterations_(InitialBurstIterations)
+{
+    board::setPumpStopVoltage(target_output_voltage);
+
+    if (build_config::AdaptivePumpTiming)
+    {
+        pump_timing_learner.restartWindow();
+    }
+}
+
+Charger::~Charger()
+{
+    board::setPumpStopVoltage(0);           // Must not outlive the charge
+}
+
+/**
+ * Adapts the length of the next burst to the remaining gap to the target voltage, so that the bursts are long
+ * early in the charge and short near the target. The energy delivered per iteration is roughly constant, so
+ * Vout^2 grows linearly with the number of iterations; the length is doubled or halved until the expected growth
+ * of Vout^2 is between 1/4 and 1/2 of the remaining gap, so the final bursts are short enough to not overshoot
+ * the target by more than the ADC resolution. Powers of two keep this free of divisions.
+ */
+void Charger::updateBurstLength(unsigned output_voltage)
+{
+    const auto voltage_sq = std::uint32_t(output_voltage * output_voltage);
+    const auto target_sq = std::uint32_t(target_output_voltage_ * target_output_voltage_);
+
+    // Nothing to learn if the growth is below the ADC resolution
+    if ((started_burst_iterations_ == 0) || (voltage_sq <= burst_start_voltage_sq_) || (voltage_sq >= target_sq))
+    {
+        return;
+    }
+
+    const std::uint32_t gap = target_sq - voltage_sq;
+    std::uint32_t growth = voltage_sq - burst_start_voltage_sq_;
+    unsigned iterations = started_burst_iterations_;
+
+    while ((iterations < MaxBurstIterations) && (growth * 4 <= gap))
+    {
+        iterations *= 2;
+        growth *= 2;
+    }
+    while ((iterations > MinBurstIterations) && (growth * 2 > gap))
+    {
+        iterations /= 2;
+        growth /= 2;
+    }
+
+    burst_iterations_ = std::min(std::max(iterations, MinBurstIterations), MaxBurstIterations);
+}
 
 Charger::Status Charger::runAndGetStatus()
 {
@@ -54,23 +343,47 @@ Charger::Status Charger::runAndGetStatus()
      * Duty cycle of 75% is probably ok, needs verification
      */
 
+    /*
+     * The previous burst may still be running if the pump is driven by the timer, see board::startPump()
+     */
+    if (board::isPumpRunning())
+    {
+        return Status::Pumping;
+    }
+
     /*
      * Error checks
      */
     const auto supply_voltage_mV = board::getSupplyVoltageInMillivolts();
     const auto ouput_voltage_V   = board::getOutVoltageInVolts();
 
-    if (supply_voltage_mV < build_config::VinMin_mV)
+    output_voltage_max_ = std::max(output_voltage_max_, ouput_voltage_V);
+
+    // Keep track of supply Voltage during switching
+    if (supply_voltage_mV < supply_voltage_mV_min_)
+    {
+        supply_voltage_mV_min_ = supply_voltage_mV;
+    }
+
+    if (build_config::AdaptivePumpTiming)
     {
-        board::syslog("ErrorFlagInputVoltageTooLow\r\n");       // We should keep this, makes it easier to diagnose power supply problems
-        board::syslog("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
+        pump_timing_learner.handleBurst(ouput_voltage_V);
+    }
+
+    updateBurstLength(ouput_voltage_V);
+    started_burst_iterations_ = 0;
+
+    if (supply_voltage_mV < params::get(params::Param::VinMinMillivolts))
+    {
+        BOARD_SYSLOG("ErrorFlagInputVoltageTooLow\r\n");       // We should keep this, makes it easier to diagnose power supply problems
+        BOARD_SYSLOG("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
         addErrorFlags(ErrorFlagInputVoltageTooLow);
     }
 
     if (supply_voltage_mV > build_config::VinMax_mV)
     {
-        board::syslog("ErrorFlagInputVoltageTooHigh\r\n");
-        board::syslog("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
+        BOARD_SYSLOG("ErrorFlagInputVoltageTooHigh\r\n");
+        BOARD_SYSLOG("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
         addErrorFlags(ErrorFlagInputVoltageTooLow);
     }
 
@@ -81,14 +394,14 @@ Charger::Status Charger::runAndGetStatus()
 #endif
         // Pint some usefull info when charger times out
         const unsigned vout =  board::getOutVoltageInVolts();
-        board::syslog("\r\n\r\nCharger timed out\r\n");
-        board::syslog("Vin         = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
-        board::syslog("Vout        = ", vout, " V\r\n");
-        board::syslog("Vout target = ",target_output_voltage_, " V\r\n");
+        BOARD_SYSLOG("\r\n\r\nCharger timed out\r\n");
+        BOARD_SYSLOG("Vin         = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
+        BOARD_SYSLOG("Vout        = ", vout, " V\r\n");
+        BOARD_SYSLOG("Vout target = ",target_output_voltage_, " V\r\n");
 
         if (vout < 160 && vout > 50)
         {
-            board::syslog("\r\n    High side Thyristor failure likely \r\n");
+            BOARD_SYSLOG("\r\n    High side Thyristor failure likely \r\n");
         }
 
         addErrorFlags(ErrorFlagTimeout);
@@ -100,7 +413,31 @@ Charger::Status Charger::runAndGetStatus()
     }
 
     /*
-     * Calculate on and off time, this will turn into a radom number generator if Vin is out of range
+     * Checked before the next burst is started, since the magnet must not be switched while the pump is running.
+     * The charge is done only when the filtered voltage has reached the target: the stop voltage is detected from
+     * a single ADC scan, which a switching spike can trigger too. The filtered voltage lags behind a burst that has
+     * been stopped at the target, so no new burst is started until it catches up or the next scan clears the stop.
+     */
+    if (ouput_voltage_V >= target_output_voltage_)
+    {
+        // Print supply Voltage when below 4.8V
+        if (supply_voltage_mV_min_ <= 4800)
+        {
+            BOARD_SYSLOG(" Vin min = ", supply_voltage_mV_min_ , " mV\r\n");
+        }
+        return Status::Done;
+    }
+
+    if (board::isPumpStopVoltageReached())
+    {
+        return Status::Pumping;
+    }
+
+    /*
+     * Look up on and off time, see pump_table. The formulas below are evaluated at compile time.
+     *
+     * On time is PRInductance_pH / (Vin - 500) [ns, mV]
+     * Off time is On time / (Vout + 1) * 50 + 1000 [ns, V]
      *
      * This is asuming that the induction is 10uH, thats a bit higher then the datasheet says.
      * The fuse F1 and the 10uF bypass cap keep the sub us peak uner 1100A and RMS under 700mA.
@@ -112,59 +449,60 @@ Charger::Status Charger::runAndGetStatus()
      * We are pushing the core right up to saturation so it's not exact science.
      */
 
-    // reduce current consumtion when Vin is low, compatiblity with crapy power rails like PixHawk or cell phone chargers
-    unsigned on_time_ns = 0;
-    unsigned off_time_ns = 0;
-    if(supply_voltage_mV < build_config::ReducedCurrentVoltage_mV)
-    {
-        on_time_ns = (build_config::PRInductance_pH - 3000000) / (supply_voltage_mV - 500);
-        off_time_ns = (((build_config::PRInductance_pH - 3000000) / (supply_voltage_mV - 500)) / (ouput_voltage_V + 1)) * 50;
-    }else{
-        on_time_ns = build_config::PRInductance_pH / (supply_voltage_mV - 500);
-        off_time_ns = ((build_config::PRInductance_pH / (supply_voltage_mV - 500)) / (ouput_voltage_V + 1)) * 50;
-    }
+    const unsigned vin_index =
+        (std::min(std::max(supply_voltage_mV, build_config::VinMin_mV), build_config::VinMax_mV) -
+         build_config::VinMin_mV) >> pump_table::VinShift;
+    const unsigned vout_index = std::min(ouput_voltage_V >> pump_table::VoutShift, pump_table::NumVoutBuckets - 1);
 
-    unsigned on_time_cy = (on_time_ns - 42) / 104;
-    unsigned off_time_cy = 0;
+    const unsigned entry = pump_table::Table[vin_index * pump_table::NumVoutBuckets + vout_index];
+    unsigned on_time_cy = entry >> 8;
+    unsigned off_time_cy = entry & 0xFFU;
 
-    off_time_ns += 1000;
+    // The learned correction is never allowed to increase the current when it is deliberately reduced
+    const bool reduced_current = isReducedCurrent(vin_index);
+    const bool adaptive = build_config::AdaptivePumpTiming && !reduced_current &&
+                          (ouput_voltage_V >= PumpTimingLearner::MinOutputVoltage);
 
-    if (off_time_ns > 360)
+    unsigned scale = timing_scale_;
+    if (adaptive)
     {
-        off_time_cy = (off_time_ns -250) / 104;
+        scale = std::min(std::max(applyTimingScale(scale, pump_timing_learner.getScale()), MinTimingScale),
+                         MaxTimingScale);
     }
-    else
+    if (reduced_current != pump_table::isReducedCurrent(vin_index))
     {
-        off_time_cy = 1;
+        scale = applyTimingScale(scale, reduced_current ? ReducedCurrentScale : FullCurrentScale);
     }
-    // When output_voltage is relaly low off time is to long
-    if (off_time_cy > 120)
+    if (scale != TimingScaleOne)
     {
-        off_time_cy = 120;
+        on_time_cy = applyTimingScale(on_time_cy, scale);
+        off_time_cy = std::min(applyTimingScale(off_time_cy, scale), pump_table::MaxOffIterations);
     }
 
     // Sanity check and run a few cycles
     if (on_time_cy > 0 && on_time_cy < 30)
     {
-        board::runPump(50, on_time_cy, off_time_cy);
-    }
+        const unsigned period_ns = (on_time_cy + off_time_cy) * board::PumpIterationNs +
+                                   board::PumpOnOverheadNs + board::PumpOffOverheadNs;
+        unsigned iterations = burst_iterations_;
+        while ((iterations > MinBurstIterations) && (iterations * period_ns > MaxBurstDurationNs))
+        {
+            iterations /= 2;
+        }
 
-    // Keep track of supply Voltage during switching
-    static unsigned supply_volatage_mV_min = 10000;
-    if (supply_voltage_mV < supply_volatage_mV_min)
-    {
-        supply_volatage_mV_min = supply_voltage_mV;
-    }
+        board::startPump(iterations, on_time_cy, off_time_cy);
 
-    // Print supply Voltage when below 4.8V
-    const unsigned output_voltage = board::getOutVoltageInVolts();
-    if (output_voltage >= target_output_voltage_ && supply_volatage_mV_min <= 4800)
-    {
-         board::syslog(" Vin min = ", supply_volatage_mV_min , " mV\r\n");
-         supply_volatage_mV_min = 10000;
+        started_burst_iterations_ = iterations;
+        num_bursts_++;
+        burst_start_voltage_sq_ = std::uint32_t(ouput_voltage_V * ouput_voltage_V);
+
+        if (adaptive)
+        {
+            pump_timing_learner.beginBurst();
+        }
     }
 
-    return (output_voltage >= target_output_voltage_) ? Status::Done : Status::InProgress;
+    return Status::InProgress;
 }
 
 }
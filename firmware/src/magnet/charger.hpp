@@ -23,6 +23,7 @@
 
 #include <sys/board.hpp>
 #include <build_config.hpp>
+#include <params.hpp>
 
 namespace charger
 {
@@ -30,21 +31,35 @@ namespace charger
 class Charger
 {
     const board::MonotonicTime deadline_ =
-        board::clock::getMonotonic() + board::MonotonicDuration::fromMSec(build_config::ChargerTimeout_ms);
+        board::clock::getMonotonic() +
+        board::MonotonicDuration::fromMSec(params::get(params::Param::ChargerTimeoutMSec));
 
     unsigned target_output_voltage_ = 0;
+    unsigned timing_scale_;                     ///< Tuned inductance relative to the default, see charger.cpp
     std::uint8_t error_flags_ = 0;
 
+    unsigned burst_iterations_;
+    unsigned started_burst_iterations_ = 0;     ///< Zero if no burst was started by the last call
+    std::uint32_t burst_start_voltage_sq_ = 0;
+
+    unsigned num_bursts_ = 0;
+    unsigned supply_voltage_mV_min_ = 0xFFFFU;
+    unsigned output_voltage_max_ = 0;
+
     void addErrorFlags(std::uint8_t x) { error_flags_ |= x; }
 
+    void updateBurstLength(unsigned output_voltage);
+
 public:
     Charger(unsigned target_output_voltage);
+    ~Charger();
 
     enum class Status : std::uint8_t
     {
         Done,
         InProgress,
-        Failure
+        Failure,
+        Pumping         ///< The previous burst is still running, or the stop voltage awaits the filter; no-op
     };
 
     Status runAndGetStatus();
@@ -56,6 +71,13 @@ public:
     static constexpr std::uint8_t ErrorFlagsBitLength          = 4;
 
     std::uint8_t getErrorFlags() const { return error_flags_; };
+
+    /*
+     * Statistics since construction, for the telemetry, see magnet::OperationReport.
+     */
+    unsigned getNumBursts() const { return num_bursts_; }
+    unsigned getMinSupplyVoltage() const { return supply_voltage_mV_min_; }
+    unsigned getMaxOutputVoltage() const { return output_voltage_max_; }
 };
 
 }
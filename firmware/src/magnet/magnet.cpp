@@ -30,6 +30,9 @@
 #include <sys/board.hpp>
 #include <uavcan/util/lazy_constructor.hpp>
 #include <build_config.hpp>
+#include <params.hpp>
+#include <algorithm>
+#include <limits>
 
 
 namespace magnet
@@ -159,12 +162,39 @@ static uavcan::LazyConstructor<charger::Charger> chrg;
  */
 static int remaining_cycles = 0;
 
+/**
+ * The thyristors are fired when the capacitor is charged, then the output voltage is checked once the ADC input
+ * has settled, to detect a failed discharge. None of the states wait in place, see poll().
+ */
+enum class State : std::uint8_t
+{
+    Idle,                                       ///< No switching in progress, remaining_cycles is zero
+    Charging,
+    Settling
+};
+
+static State state = State::Idle;
+
+static const board::MonotonicDuration PostFireSettleTime = board::MonotonicDuration::fromMSec(4);
+
+static board::MonotonicTime settle_deadline;
+
 static Health health = Health::Ok;
 
 static std::uint8_t charger_status_flags = 0;
 
 static bool magnet_is_on = false;               ///< This is default
 
+/*
+ * Metrics of the command in progress, see OperationReport.
+ */
+static OperationReport operation;
+static OperationReport last_operation;
+static board::MonotonicTime operation_start_ts;
+static board::MonotonicTime cycle_start_ts;
+static unsigned operation_charge_time_ms = 0;
+static unsigned operation_num_charges = 0;
+
 static board::MonotonicTime last_command_ts;
 
 signed duty_cycle_counter = 13000;              // when charging is in progress this counter can run negative, it's a better approximation for the limit
@@ -176,77 +206,226 @@ void updateChargerStatusFlags(std::uint8_t x)
     charger_status_flags = x;
 }
 
-void pollOn()
+/*
+ * Standby precharge, see build_config::StandbyPrecharge.
+ * While idle, the capacitor is kept between StandbyLowVoltage and the target of the first switching cycle, so
+ * that the first cycle of the next command is fired right away instead of charging from zero.
+ *
+ * The idle power is the capacitor leakage plus the pump losses. The voltage is checked at an interval that
+ * adapts to the observed leakage, so the ADC is not read more often than needed to catch the low threshold.
+ * If the capacitor keeps leaking faster than StandbyMinTopUpInterval allows, the standby is suspended until reboot.
+ *
+ * The top ups have their own duty cycle budget, so that a leaky capacitor cannot exhaust the budget of the commands
+ * before the leak is detected; a top up is postponed while the budget is exhausted.
+ */
+static constexpr unsigned StandbyLowVoltage = 465;
+
+static const board::MonotonicDuration StandbyMinCheckInterval = board::MonotonicDuration::fromMSec(10);
+static const board::MonotonicDuration StandbyMaxCheckInterval = board::MonotonicDuration::fromMSec(1000);
+static const board::MonotonicDuration StandbyMinTopUpInterval = board::MonotonicDuration::fromMSec(200);
+static constexpr unsigned StandbyMaxFastTopUps = 3;
+
+static bool standby_suspended = false;
+static bool standby_charged = false;                    ///< The first cycle can be fired right away
+static unsigned standby_last_voltage = 0;
+static board::MonotonicDuration standby_check_interval = StandbyMinCheckInterval;
+static board::MonotonicTime standby_next_check_ts;
+static board::MonotonicTime standby_last_top_up_ts;    ///< Zero if there was a command since the last top up
+static unsigned standby_fast_top_ups = 0;
+
+constexpr signed StandbyDutyCycleCounterMax = DutyCycleCounterMax / 4;
+static signed standby_duty_cycle_counter = StandbyDutyCycleCounterMax;
+
+/**
+ * Target voltage of a switching cycle. The standby charge, if present, is fired right away by the first cycle.
+ */
+unsigned getTargetVoltage(unsigned nominal)
 {
-    if (!chrg.isConstructed())
+    if (build_config::StandbyPrecharge && standby_charged)
     {
-        chrg.construct<unsigned>(475);
+        standby_charged = false;
+        return std::min(nominal, StandbyLowVoltage);
     }
+    return nominal;
+}
 
-    const auto status = chrg->runAndGetStatus();
-    updateChargerStatusFlags(chrg->getErrorFlags());
+void suspendStandby(const char* reason)
+{
+    BOARD_SYSLOG("\r\nStandby suspended: ");
+    board::syslog(reason);
+    BOARD_SYSLOG("\r\n");
+    standby_suspended = true;
+    standby_charged = false;
+    health = Health::Warning;
+}
 
-    if (status == charger::Charger::Status::InProgress)
+void pollStandby()
+{
+    if (standby_suspended || (health == Health::Error))
     {
-        duty_cycle_counter--;
+        return;
     }
-    else if (status == charger::Charger::Status::Done)
-    {
-        board::setMagnetPos();          // The cap is charged, switching the magnet
-        magnet_is_on = true;
 
-        // Print some info when capacitor fails to discharge and delcare error
+    const auto ts = board::clock::getMonotonic();
 
-        board::delayMSec(4);                   // Wait until ADC cap settles
-        const unsigned Vout = board::getOutVoltageInVolts();
+    if (chrg.isConstructed())                   // Top up in progress
+    {
+        const auto status = chrg->runAndGetStatus();
+        updateChargerStatusFlags(chrg->getErrorFlags());
 
-        if (Vout > 100)
+        if (status == charger::Charger::Status::InProgress)
+        {
+            standby_duty_cycle_counter--;
+        }
+        else if (status == charger::Charger::Status::Done)
         {
-            board::syslog("\r\nCapacitor failed to discharge \r\n");
-            board::syslog("Thyristor D20 on CTRL2 or D23 on CTRL3 failed to fire. Or open magnet winding \r\n");
-            board::syslog("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
-            board::syslog("Vout = ", Vout, " V\r\n");
-
             chrg.destroy();
-            remaining_cycles = 0;
-            health = Health::Error;
+            standby_charged = true;
+            standby_last_voltage = TurnOffCycleArray[0][0];
+            standby_last_top_up_ts = ts;
+            standby_check_interval = StandbyMinCheckInterval;
+            standby_next_check_ts = ts + standby_check_interval;
+        }
+        else if (status == charger::Charger::Status::Failure)
+        {
+            chrg.destroy();
+            suspendStandby("charger failure");
         }
         else
         {
-            chrg.destroy();                 // Then updating the state
-            remaining_cycles--;
-            health = Health::Ok;
+            ;
         }
+        return;
     }
-    else                                    // Charge timed out
+
+    if (ts < standby_next_check_ts)
     {
-        chrg.destroy();
-        remaining_cycles = 0;
-        health = Health::Error;
+        return;
     }
+
+    const unsigned vout = board::getOutVoltageInVolts();
+    if (vout >= StandbyLowVoltage)
+    {
+        // Slowing down while the drop per check is under 1/4 of the margin, speeding up when it exceeds 1/2
+        const unsigned margin = vout - StandbyLowVoltage;
+        const unsigned drop = (standby_last_voltage > vout) ? (standby_last_voltage - vout) : 0;
+
+        if ((drop * 4 <= margin) && (standby_check_interval < StandbyMaxCheckInterval))
+        {
+            standby_check_interval = standby_check_interval * 2;
+        }
+        else if ((drop * 2 > margin) && (standby_check_interval > StandbyMinCheckInterval))
+        {
+            standby_check_interval = board::MonotonicDuration::fromUSec(standby_check_interval.toUSec() / 2);
+        }
+        else
+        {
+            ;
+        }
+
+        standby_charged = true;
+        standby_last_voltage = vout;
+        standby_next_check_ts = ts + standby_check_interval;
+        return;
+    }
+
+    standby_charged = false;
+    standby_next_check_ts = ts + StandbyMinCheckInterval;
+
+    // The commands have the priority over the standby
+    if ((duty_cycle_counter < DutyCycleCounterMax / 2) || (standby_duty_cycle_counter < 0))
+    {
+        return;
+    }
+
+    if (!standby_last_top_up_ts.isZero() && ((ts - standby_last_top_up_ts) < StandbyMinTopUpInterval))
+    {
+        if (++standby_fast_top_ups >= StandbyMaxFastTopUps)
+        {
+            suspendStandby("capacitor leakage is too high");
+            return;
+        }
+    }
+    else
+    {
+        standby_fast_top_ups = 0;
+    }
+
+    chrg.construct<unsigned>(TurnOffCycleArray[0][0]);
+}
+
+void beginOperation(bool turn_on)
+{
+    operation = OperationReport();
+    operation.turn_on = turn_on;
+    operation.min_supply_voltage_mV = std::numeric_limits<std::uint16_t>::max();
+    operation_charge_time_ms = 0;
+    operation_num_charges = 0;
+    operation_start_ts = board::clock::getMonotonic();
+    cycle_start_ts = operation_start_ts;
+}
+
+/**
+ * Called when the charger of the current cycle finishes. The first cycle is timed from the command, so with the
+ * standby precharge its charge time is close to zero, and the statistics of its charger include the top ups.
+ */
+void accountCharge()
+{
+    const auto charge_time_ms = unsigned((board::clock::getMonotonic() - cycle_start_ts).toMSec());
+    operation_charge_time_ms += charge_time_ms;
+    operation_num_charges++;
+
+    operation.max_charge_time_ms =
+        std::uint16_t(std::min<unsigned>(std::max<unsigned>(operation.max_charge_time_ms, charge_time_ms), 0xFFFFU));
+    operation.num_bursts = std::uint16_t(std::min(operation.num_bursts + chrg->getNumBursts(), 0xFFFFU));
+    operation.min_supply_voltage_mV =
+        std::uint16_t(std::min<unsigned>(operation.min_supply_voltage_mV, chrg->getMinSupplyVoltage()));
+    operation.peak_output_voltage_V =
+        std::uint16_t(std::min(std::max<unsigned>(operation.peak_output_voltage_V, chrg->getMaxOutputVoltage()),
+                               0xFFFFU));
 }
 
-void pollOff()
+void endOperation(bool failed)
 {
-    const unsigned cycle_index = TurnOffCycleArraySize - unsigned(-remaining_cycles);
+    operation.failed = failed;
+    operation.mean_charge_time_ms =
+        std::uint16_t(std::min(operation_charge_time_ms / std::max(operation_num_charges, 1U), 0xFFFFU));
+    operation.sequence_time_ms = std::uint16_t(
+        std::min(unsigned((board::clock::getMonotonic() - operation_start_ts).toMSec()), 0xFFFFU));
+    operation.sequence = std::uint16_t(last_operation.sequence + 1U);
+    last_operation = operation;
+}
 
-    const auto cycle_array_item = TurnOffCycleArray[cycle_index];
+/**
+ * Starts the current switching cycle once the capacitor is charged to its target voltage.
+ */
+void pollCharging()
+{
+    const bool turning_on = remaining_cycles > 0;
+    const unsigned cycle_index = turning_on ? 0U : (TurnOffCycleArraySize - unsigned(-remaining_cycles));
 
     if (!chrg.isConstructed())
     {
-        chrg.construct<unsigned>(cycle_array_item[0]);
+        chrg.construct<unsigned>(getTargetVoltage(turning_on ? 475U : TurnOffCycleArray[cycle_index][0]));
     }
 
     const auto status = chrg->runAndGetStatus();
     updateChargerStatusFlags(chrg->getErrorFlags());
 
-    if (status == charger::Charger::Status::InProgress)
+    if (status == charger::Charger::Status::Pumping)
+    {
+        ;
+    }
+    else if (status == charger::Charger::Status::InProgress)
     {
         duty_cycle_counter--;
     }
     else if (status == charger::Charger::Status::Done)
     {
-        if (cycle_array_item[1])        // The cap is charged, switching the magnet
+        accountCharge();
+        operation.num_cycles++;
+
+        if (turning_on || TurnOffCycleArray[cycle_index][1])      // The cap is charged, switching the magnet
         {
             board::setMagnetPos();
         }
@@ -254,32 +433,61 @@ void pollOff()
         {
             board::setMagnetNeg();
         }
-        magnet_is_on = false;
-
-        // Print some info when capacitor fails to discharge and delcare error
-        board::delayMSec(4);                   // Wait until ADC cap settles
-        const unsigned Vout = board::getOutVoltageInVolts();
-        if (Vout > 100)                        // 1ms is not really enough hence 100V
-        {
-            board::syslog("\r\nCapacitor failed to discharge \r\n");
-            board::syslog("Thyristor D20 on CTRL2 or D23 on CTRL3 failed to fire. Or open magnet winding \r\n");
-            board::syslog("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
-            board::syslog("Vout = ", Vout, " V\r\n");
-
-            health = Health::Error;
-            remaining_cycles = 0;
-            chrg.destroy();
-        }
+        magnet_is_on = turning_on;
 
         chrg.destroy();
-        remaining_cycles++;
-        health = Health::Ok;
+        settle_deadline = board::clock::getMonotonic() + PostFireSettleTime;
+        state = State::Settling;
     }
-    else                    // Charger timed out
+    else                                    // Charge timed out
     {
+        accountCharge();
+        endOperation(true);
+
         chrg.destroy();
         remaining_cycles = 0;
         health = Health::Error;
+        state = State::Idle;
+    }
+}
+
+/**
+ * Completes the current switching cycle once the ADC input has settled after the fire.
+ */
+void pollSettling()
+{
+    if (board::clock::getMonotonic() < settle_deadline)
+    {
+        return;
+    }
+
+    // Print some info when capacitor fails to discharge and delcare error
+    const unsigned Vout = board::getOutVoltageInVolts();
+    if (Vout > 100)                        // 1ms is not really enough hence 100V
+    {
+        BOARD_SYSLOG("\r\nCapacitor failed to discharge \r\n");
+        BOARD_SYSLOG("Thyristor D20 on CTRL2 or D23 on CTRL3 failed to fire. Or open magnet winding \r\n");
+        BOARD_SYSLOG("Vin  = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
+        BOARD_SYSLOG("Vout = ", Vout, " V\r\n");
+
+        remaining_cycles = 0;
+        health = Health::Error;
+    }
+    else
+    {
+        remaining_cycles += (remaining_cycles > 0) ? -1 : 1;
+        health = Health::Ok;
+    }
+
+    if (remaining_cycles == 0)
+    {
+        endOperation(health == Health::Error);
+        state = State::Idle;
+    }
+    else
+    {
+        cycle_start_ts = board::clock::getMonotonic();
+        state = State::Charging;
     }
 }
 
@@ -290,19 +498,22 @@ void turnOn(unsigned num_cycles)
     if (remaining_cycles == 0)          // Ignore the command if switching is already in progress
     {
         // Print some usefull info
-        board::syslog("\r\n On command received \r\n");
-        board::syslog(" Vin         = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
+        BOARD_SYSLOG("\r\n On command received \r\n");
+        BOARD_SYSLOG(" Vin         = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
 
         // Check rate limiting
         if (duty_cycle_counter< 0)
         {
-            board::syslog("\r\nRate limiting\r\n\r\n");
+            BOARD_SYSLOG("\r\nRate limiting\r\n\r\n");
             return;         // Rate limiting
         }
 
         num_cycles = std::max<unsigned>(MinTurnOnCycles, num_cycles);
         num_cycles = std::min<unsigned>(MaxCycles, num_cycles);
         remaining_cycles = int(num_cycles);
+        state = State::Charging;
+        standby_last_top_up_ts = board::MonotonicTime();
+        beginOperation(true);
     }
 }
 
@@ -311,30 +522,71 @@ void turnOff()
     if (remaining_cycles == 0)          // Ignore the command if switching is already in progress
     {
         // Print some usefull inf
-        board::syslog("\r\n Off command received \r\n");
-        board::syslog(" Vin         = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
+        BOARD_SYSLOG("\r\n Off command received \r\n");
+        BOARD_SYSLOG(" Vin         = ", board::getSupplyVoltageInMillivolts(), " mV\r\n");
 
         // Check rate limiting
         if (duty_cycle_counter < 0)
         {
-            board::syslog("\r\nRate limiting\r\n\r\n");
+            BOARD_SYSLOG("\r\nRate limiting\r\n\r\n");
             return;         // Rate limiting
         }
 
         remaining_cycles = -int(TurnOffCycleArraySize);
+        state = State::Charging;
+        standby_last_top_up_ts = board::MonotonicTime();
+        beginOperation(false);
 
+        // The standby charge is meant for the first cycle, it must not be fired by a skipped-to one, hence
+        // the parameter is fixed at zero with the standby precharge, see params.cpp
         if (!magnet_is_on)
         {
-            remaining_cycles += build_config::cycles_to_skip;
+            // At least one cycle is always executed
+            remaining_cycles += int(std::min(params::get(params::Param::TurnOffCyclesToSkip),
+                                             TurnOffCycleArraySize - 1U));
         }
     }
 }
 
+void handleCommand(unsigned command)
+{
+    /*
+     * The last command field is initialized at an impossible value in order to force a switch once
+     * the first command is received. This will force the magnet into a known state.
+     */
+    static unsigned last_command = std::numeric_limits<unsigned>::max();
+
+    if ((bool(command) != isTurnedOn()) || (command != last_command))
+    {
+        if (command == 0)
+        {
+            turnOff();
+        }
+        else
+        {
+            turnOn(command);
+        }
+    }
+
+    // Oi moroz moroz ne moroz' mena
+    last_command = command;     // Ne moroz' mena moigo kona
+}
+
 bool isTurnedOn()
 {
     return magnet_is_on;
 }
 
+bool isSwitching()
+{
+    return remaining_cycles != 0;
+}
+
+bool isIdle()
+{
+    return (state == State::Idle) && !chrg.isConstructed();
+}
+
 void poll()
 {
     const auto ts = board::clock::getMonotonic();
@@ -349,19 +601,43 @@ void poll()
         {
             duty_cycle_counter = DutyCycleCounterMax;
         }
+
+        if (build_config::StandbyPrecharge)
+        {
+            standby_duty_cycle_counter = std::min(standby_duty_cycle_counter + 180 / 4, StandbyDutyCycleCounterMax);
+        }
     }
 
-    if (remaining_cycles > 0)
+#if HARDPOINT_FAST_PATH
+    // Applied right away, so that the switching starts in this call
+    std::uint16_t command = 0;
+    if (board::takeHardpointCommand(command))
     {
-        pollOn();
+        handleCommand(command);
     }
-    else if (remaining_cycles < 0)
+#endif
+
+    switch (state)
     {
-        pollOff();
+    case State::Charging:
+    {
+        pollCharging();
+        break;
     }
-    else
+    case State::Settling:
     {
-        ;
+        pollSettling();
+        break;
+    }
+    case State::Idle:
+    default:
+    {
+        if (build_config::StandbyPrecharge)
+        {
+            pollStandby();
+        }
+        break;
+    }
     }
 }
 
@@ -370,6 +646,11 @@ Health getHealth()
     return health;
 }
 
+const OperationReport& getLastOperationReport()
+{
+    return last_operation;
+}
+
 std::uint8_t getStatusFlags()
 {
     static constexpr std::uint8_t StatusFlagSwitchingOn  = 1 << (charger::Charger::ErrorFlagsBitLength + 0);
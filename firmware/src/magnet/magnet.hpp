@@ -27,9 +27,15 @@ namespace magnet
 {
 /**
  * This function will be called by the application wit maximum possible rate (typically > 1 kHz).
+ * With build_config::StandbyPrecharge, it also keeps the capacitor charged while idle.
+ *
+ * This function never waits in place, so it returns within MaxPollDurationUSec. The longest call is a pump
+ * burst in the busy loop mode, limited by the charger.
  */
 void poll();
 
+static constexpr unsigned MaxPollDurationUSec = 1000;
+
 /**
  * Maximum number of turn on/off switching cycles.
  */
@@ -47,8 +53,27 @@ void turnOn(unsigned num_cycles);
  */
 void turnOff();
 
+/**
+ * Applies the hardpoint command: zero turns the magnet off, otherwise this is the number of cycles to turn it on.
+ * A repeated command is ignored if the magnet is already in the requested state, so that the commands broadcast
+ * periodically do not restart the switching. With HARDPOINT_FAST_PATH, poll() applies the commands latched by the
+ * CAN interrupt, and the same command delivered by libuavcan later has no effect.
+ */
+void handleCommand(unsigned command);
+
 bool isTurnedOn();
 
+/**
+ * Whether a command is being executed, i.e. the switching cycles have not finished yet.
+ */
+bool isSwitching();
+
+/**
+ * Whether poll() has nothing to do until the next command: no switching in progress and no standby top up.
+ * The application lets the MCU sleep then, see board::sleepUntilInterrupt().
+ */
+bool isIdle();
+
 enum class Health : std::uint8_t
 {
     Ok,
@@ -60,4 +85,24 @@ Health getHealth();
 
 std::uint8_t getStatusFlags();
 
+/**
+ * Metrics of the last completed command, so that the slow units can be spotted across the fleet.
+ * The application publishes them once per command, see the sequence number.
+ */
+struct OperationReport
+{
+    std::uint16_t sequence = 0;                 ///< Incremented per completed command, zero if there was none yet
+    bool turn_on = false;
+    bool failed = false;                        ///< The charger timed out or the capacitor failed to discharge
+    std::uint8_t num_cycles = 0;                ///< Fired switching cycles
+    std::uint16_t mean_charge_time_ms = 0;      ///< Per cycle, from its start to the capacitor reaching the target
+    std::uint16_t max_charge_time_ms = 0;
+    std::uint16_t sequence_time_ms = 0;         ///< From the command to the end of the last cycle
+    std::uint16_t min_supply_voltage_mV = 0;    ///< While pumping
+    std::uint16_t num_bursts = 0;               ///< Pump bursts of all cycles
+    std::uint16_t peak_output_voltage_V = 0;
+};
+
+const OperationReport& getLastOperationReport();
+
 }
@@ -22,11 +22,16 @@
 #include <cstdio>
 #include <algorithm>
 #include <sys/board.hpp>
+#include <sys/profiler.hpp>
 #include <uavcan_lpc11c24/uavcan_lpc11c24.hpp>
 #include <uavcan/equipment/hardpoint/Command.hpp>
 #include <uavcan/equipment/hardpoint/Status.hpp>
 #include <uavcan/protocol/dynamic_node_id_client.hpp>
+#include <uavcan/protocol/NodeStatus.hpp>
+#include <uavcan/protocol/debug/KeyValue.hpp>
+#include <uavcan/protocol/param_server.hpp>
 #include <magnet/magnet.hpp>
+#include <params.hpp>
 
 namespace
 {
@@ -154,7 +159,84 @@ void callPollAndResetWatchdog()
     /*
      * Magnet update
      */
-    magnet::poll();
+    {
+        profiler::ScopedSection section(profiler::Section::Magnet);
+        magnet::poll();
+    }
+}
+
+/**
+ * Every node publishes uavcan.protocol.NodeStatus at least once a second.
+ */
+static constexpr unsigned NodeStatusListeningMSec = 1100;
+
+/**
+ * Listens at the bit rate stored at the last boot, in the silent mode, so that a wrong one does not disturb the bus.
+ * A frame received without errors confirms it, and the driver is then initialized at this bit rate.
+ */
+bool tryStoredBitRate(std::uint32_t bit_rate)
+{
+    if (!board::startCanBitRateProbe(bit_rate))
+    {
+        return false;
+    }
+
+    bool confirmed = false;
+    const auto deadline = board::clock::getMonotonic() + uavcan::MonotonicDuration::fromMSec(NodeStatusListeningMSec);
+    while (!confirmed && (board::clock::getMonotonic() < deadline))
+    {
+        callPollAndResetWatchdog();
+        confirmed = board::isCanBitRateConfirmed();
+    }
+
+    board::stopCanBitRateProbe();
+    return confirmed && (uavcan_lpc11c24::CanDriver::instance().init(bit_rate) >= 0);
+}
+
+/**
+ * The config read at boot; the parameters are saved into it, so that the stored bit rate and node ID are kept.
+ */
+board::PersistentConfig persistent_config;
+
+bool node_id_conflict = false;
+
+void handleNodeStatus(const uavcan::ReceivedDataStructure<uavcan::protocol::NodeStatus>& msg)
+{
+    if (msg.getSrcNodeID() == getNode().getNodeID())
+    {
+        node_id_conflict = true;
+    }
+}
+
+/**
+ * The node ID stored at the last boot is claimed right away, without listening to the bus first. Another node may
+ * have got it from the allocator meanwhile, so the NodeStatus messages are watched for our own node ID for as long
+ * as the node runs, see handleNodeIDConflict().
+ */
+void startNodeIDConflictMonitor()
+{
+    static uavcan::Subscriber<uavcan::protocol::NodeStatus,
+                              void (*)(const uavcan::ReceivedDataStructure<uavcan::protocol::NodeStatus>&)>
+        sub(getNode());
+    if (sub.start(reinterpret_cast<decltype(sub)::Callback>(&handleNodeStatus)) < 0)
+    {
+        board::die();
+    }
+}
+
+/**
+ * On a conflict, the stored node ID is dropped and the node restarts, so that the next boot allocates a new one.
+ * Not while switching, lest the magnet be left half switched.
+ */
+void handleNodeIDConflict()
+{
+    if (node_id_conflict && !magnet::isSwitching())
+    {
+        BOARD_SYSLOG("Node ID conflict\r\n");
+        persistent_config.node_id = 0;
+        (void)board::writePersistentConfig(persistent_config);
+        board::restart();
+    }
 }
 
 uavcan::NodeID performDynamicNodeIDAllocation()
@@ -214,6 +296,94 @@ void fillNodeInfo()
     }
 }
 
+/**
+ * The filter that accepts everything the two filters accept. The bits where the IDs differ are removed from the mask.
+ */
+uavcan::CanFilterConfig mergeFilters(const uavcan::CanFilterConfig& a, const uavcan::CanFilterConfig& b)
+{
+    uavcan::CanFilterConfig res;
+    res.mask = a.mask & b.mask & ~(a.id ^ b.id);
+    res.id = a.id & res.mask;
+    return res;
+}
+
+/**
+ * Merges the filters in place until there are no more than max_configs of them, each time merging the pair whose
+ * merged filter keeps the most mask bits, i.e. lets through the fewest extra frames. This is O(N^3), but N is bounded
+ * by MaxFilterConfigs (32) in configureAcceptanceFilters(), so there are at most about 5500 pairs to evaluate at
+ * startup, or about 500 when a single pair is merged to make room; unlike the compaction of libuavcan it needs
+ * no memory.
+ */
+unsigned compactFilters(uavcan::CanFilterConfig* configs, unsigned num_configs, unsigned max_configs)
+{
+    while (num_configs > std::max(max_configs, 1U))
+    {
+        unsigned best_a = 0;
+        unsigned best_b = 1;
+        int best_mask_bits = -1;
+
+        for (unsigned a = 0; a < num_configs; a++)
+        {
+            for (unsigned b = a + 1; b < num_configs; b++)
+            {
+                const int mask_bits = __builtin_popcount(mergeFilters(configs[a], configs[b]).mask);
+                if (mask_bits > best_mask_bits)
+                {
+                    best_a = a;
+                    best_b = b;
+                    best_mask_bits = mask_bits;
+                }
+            }
+        }
+
+        configs[best_a] = mergeFilters(configs[best_a], configs[best_b]);
+        configs[best_b] = configs[num_configs - 1];
+        num_configs--;
+    }
+
+    return num_configs;
+}
+
+struct CanFilterStats
+{
+    unsigned num_needed = 0;
+    unsigned num_used = 0;
+    unsigned accepted_data_types = 0;
+};
+
+CanFilterStats can_filter_stats;
+
+/**
+ * The received frames are the ones that have passed the acceptance filters, i.e. the receive load of the software.
+ */
+void logCanStats()
+{
+    const auto rx = getNode().getDispatcher().getCanIOManager().getIfacePerfCounters(0).frames_rx;
+    BOARD_SYSLOG("CAN filters: ", can_filter_stats.num_needed);
+    BOARD_SYSLOG(" needed, ", can_filter_stats.num_used);
+    BOARD_SYSLOG(" used, message types accepted: ", can_filter_stats.accepted_data_types);
+    BOARD_SYSLOG(", frames received: ", static_cast<long long>(rx), "\r\n");
+}
+
+/**
+ * Logs the CAN statistics periodically, so that the effect of the filters can be seen on the target.
+ */
+static constexpr unsigned CanStatsLogIntervalMSec = 60000;
+
+void logCanStatsPeriodically()
+{
+    // The first report is logged by configureAcceptanceFilters()
+    static board::MonotonicTime next_log_ts =
+        board::clock::getMonotonic() + board::MonotonicDuration::fromMSec(CanStatsLogIntervalMSec);
+
+    const auto ts = board::clock::getMonotonic();
+    if (ts >= next_log_ts)
+    {
+        next_log_ts = ts + board::MonotonicDuration::fromMSec(CanStatsLogIntervalMSec);
+        logCanStats();
+    }
+}
+
 void configureAcceptanceFilters()
 {
     // These masks are specific for UAVCAN - we're using only extended data frames and nothing else.
@@ -227,39 +397,60 @@ void configureAcceptanceFilters()
     static constexpr auto ServiceIDBits   = 0x80U;
     static constexpr auto ServiceMaskBits = 0x7F80U;
 
-    // Allocating a buffer large enough to fit all filters the application may need.
     static constexpr unsigned MaxFilterConfigs = 32;
     uavcan::CanFilterConfig filter_configs[MaxFilterConfigs];
-    std::uint16_t filter_config_index = 0;
+    unsigned num_configs = 0;
+    unsigned num_listeners = 0;
 
-    // Building message filters.
+    // Building message filters. Once the buffer is full, the closest pair is merged to make room for the next one;
+    // the last slot is kept for the unicast transfers below.
     auto p = getNode().getDispatcher().getListOfMessageListeners().get();
     while (p != NULL)
     {
-        filter_configs[filter_config_index].id =
+        if (num_configs >= MaxFilterConfigs - 1U)
+        {
+            num_configs = compactFilters(filter_configs, num_configs, num_configs - 1U);
+        }
+
+        filter_configs[num_configs].id =
             (static_cast<unsigned>(p->getDataTypeDescriptor().getID().get()) << NodeIDShift) | CommonIDBits;
 
-        filter_configs[filter_config_index].mask = MessageMaskBits | CommonMaskBits;
+        filter_configs[num_configs].mask = MessageMaskBits | CommonMaskBits;
 
         p = p->getNextListNode();
 
-        filter_config_index++;
-        if (filter_config_index >= std::min<unsigned>(MaxFilterConfigs,
-                                                      uavcan_lpc11c24::CanDriver::instance().getNumFilters()))
-        {
-            board::die(); // Filter compaction algorithm defined in libuavcan is not used because of memory constraints
-        }
+        num_configs++;
+        num_listeners++;
+    }
+
+    // Merging the message filters if there are more of them than the message objects of the CAN controller, but one
+    const unsigned num_filters = std::max<unsigned>(uavcan_lpc11c24::CanDriver::instance().getNumFilters(), 2U);
+    num_configs = compactFilters(filter_configs, num_configs, num_filters - 1U);
+
+    // Upper bound, the merged filters may overlap
+    unsigned accepted_data_types = 0;
+    for (unsigned i = 0; i < num_configs; i++)
+    {
+        const auto ignored_bits = __builtin_popcount(~filter_configs[i].mask & (MessageMaskBits & ~ServiceIDBits));
+        accepted_data_types += 1U << ignored_bits;
     }
 
     // Adding one filter for unicast transfers - note that it's filtering on our Node ID.
-    filter_configs[filter_config_index].id =
+    // It is added after the merging, so that it is never widened.
+    filter_configs[num_configs].id =
         ServiceIDBits | (static_cast<unsigned>(getNode().getNodeID().get()) << NodeIDShift) | CommonIDBits;
-    filter_configs[filter_config_index].mask = ServiceMaskBits | CommonMaskBits;
+    filter_configs[num_configs].mask = ServiceMaskBits | CommonMaskBits;
+
+    num_configs++;
 
-    filter_config_index++;
+    can_filter_stats.num_needed = num_listeners + 1U;
+    can_filter_stats.num_used = num_configs;
+    can_filter_stats.accepted_data_types = accepted_data_types;
+    logCanStats();
 
     // Sending the configuration to the CAN driver.
-    if (uavcan_lpc11c24::CanDriver::instance().configureFilters(filter_configs, filter_config_index) < 0)
+    if (uavcan_lpc11c24::CanDriver::instance().configureFilters(filter_configs,
+                                                                static_cast<std::uint16_t>(num_configs)) < 0)
     {
         board::die();
     }
@@ -272,26 +463,7 @@ void handleHardpointCommand(const uavcan::equipment::hardpoint::Command& msg)
         return;
     }
 
-    /*
-     * The last command field is initialized at an impossible value in order to force a switch once
-     * the first command is received. This will force the magnet into a known state.
-     */
-    static unsigned last_command = std::numeric_limits<unsigned>::max();
-
-    if ((bool(msg.command) != magnet::isTurnedOn()) || (msg.command != last_command))
-    {
-        if (msg.command == 0)
-        {
-            magnet::turnOff();
-        }
-        else
-        {
-            magnet::turnOn(msg.command);
-        }
-    }
-
-    // Oi moroz moroz ne moroz' mena
-    last_command = msg.command; // Ne moroz' mena moigo kona
+    magnet::handleCommand(msg.command);
 }
 
 void publishHardpointStatus()
@@ -319,8 +491,16 @@ void publishHardpointStatus()
     (void)pub.broadcast(msg);
 }
 
-void updateUavcanStatus(const uavcan::TimerEvent&)
+/**
+ * The magnet state is the only field of the hardpoint status that changes, so it is the only one watched by
+ * publishStatusOnChange().
+ */
+bool last_published_turned_on = false;
+
+void updateUavcanStatus()
 {
+    last_published_turned_on = magnet::isTurnedOn();
+
     publishHardpointStatus();
 
     switch (magnet::getHealth())
@@ -346,6 +526,201 @@ void updateUavcanStatus(const uavcan::TimerEvent&)
         static_cast<std::uint16_t>(magnet::getStatusFlags() | ((board::getOutVoltageInVolts() >> 1) << 8)));
 }
 
+void handleStatusTimer(const uavcan::TimerEvent&)
+{
+    updateUavcanStatus();
+}
+
+typedef uavcan::TimerEventForwarder<void (*)(const uavcan::TimerEvent&)> StatusTimer;
+
+/**
+ * The period is a parameter, so the timer is restarted when it changes.
+ */
+StatusTimer& getStatusTimer()
+{
+    static StatusTimer timer(getNode());
+    return timer;
+}
+
+void startStatusTimer()
+{
+    getStatusTimer().startPeriodic(
+        uavcan::MonotonicDuration::fromMSec(params::get(params::Param::StatusPeriodMSec)));
+}
+
+/**
+ * Publishes the status right away when the magnet changes its state, so that the autopilot does not wait for the
+ * periodic publication to learn about a release. The health is reported in NodeStatus, which is updated with every
+ * publication. The publications are rate limited to protect the bus; a change within the interval is published once
+ * it expires.
+ */
+static constexpr unsigned MinStatusEventIntervalMSec = 20;
+
+void publishStatusOnChange()
+{
+    static board::MonotonicTime next_publication_ts;
+
+    const auto ts = board::clock::getMonotonic();
+    if ((ts >= next_publication_ts) && (magnet::isTurnedOn() != last_published_turned_on))
+    {
+        updateUavcanStatus();
+        next_publication_ts = ts + board::MonotonicDuration::fromMSec(MinStatusEventIntervalMSec);
+    }
+}
+
+/**
+ * Exposes the parameters (see params.hpp) via the standard UAVCAN parameter services. Only the integer values are
+ * accepted; the values out of range are ignored, and the response reports the value that stays in effect.
+ */
+class ParamManager : public uavcan::IParamManager
+{
+    /*
+     * A config that is already stored is not written again, so that the repeated saves do not wear the flash.
+     * Otherwise the flash is not programmed while switching, because the interrupts are disabled meanwhile.
+     * Each write takes a page of the config sector, see board::writePersistentConfig().
+     */
+    static int storeConfig(const board::PersistentConfig& config)
+    {
+        board::PersistentConfig stored;
+        if (!(board::tryReadPersistentConfig(stored) && (stored == config)))
+        {
+            if (magnet::isSwitching() || !board::writePersistentConfig(config))
+            {
+                return -1;
+            }
+        }
+        persistent_config = config;
+        return 0;
+    }
+
+    void getParamNameByIndex(Index index, Name& out_name) const override
+    {
+        const auto descr = params::getDescriptor(index);
+        if (descr != nullptr)
+        {
+            out_name = descr->name;
+        }
+    }
+
+    void assignParamValue(const Name& name, const Value& value) override
+    {
+        const unsigned index = params::findByName(name.c_str());
+        const auto x = value.as<Value::Tag::integer_value>();
+        if ((x == nullptr) || (*x < 0) || (*x > std::numeric_limits<unsigned>::max()))
+        {
+            return;
+        }
+
+        if (params::set(index, static_cast<unsigned>(*x)) &&
+            (index == static_cast<unsigned>(params::Param::StatusPeriodMSec)))
+        {
+            startStatusTimer();
+        }
+    }
+
+    void readParamValue(const Name& name, Value& out_value) const override
+    {
+        const unsigned index = params::findByName(name.c_str());
+        if (index < params::NumParams)
+        {
+            out_value.to<Value::Tag::integer_value>() = params::get(static_cast<params::Param>(index));
+        }
+    }
+
+    void readParamDefaultMaxMin(const Name& name, Value& out_default,
+                                NumericValue& out_max, NumericValue& out_min) const override
+    {
+        const auto descr = params::getDescriptor(params::findByName(name.c_str()));
+        if (descr != nullptr)
+        {
+            out_default.to<Value::Tag::integer_value>() = descr->default_value;
+            out_max.to<NumericValue::Tag::integer_value>() = descr->max_value;
+            out_min.to<NumericValue::Tag::integer_value>() = descr->min_value;
+        }
+    }
+
+    int saveAllParams() override
+    {
+        auto config = persistent_config;
+        params::store(config);
+        return storeConfig(config);
+    }
+
+    /*
+     * The defaults take effect once they are stored, so that the values in effect match the flash.
+     */
+    int eraseAllParams() override
+    {
+        auto config = persistent_config;
+        config.num_params = 0;
+        config.params.fill(0);
+        const int res = storeConfig(config);
+        if (res >= 0)
+        {
+            params::resetToDefaults();
+            startStatusTimer();
+        }
+        return res;
+    }
+};
+
+/**
+ * Publishes the metrics of every completed command (see magnet::OperationReport) as uavcan.protocol.debug.KeyValue
+ * messages, one per metric and at most one per call, so that a command does not put a burst of messages on the bus.
+ * A newer report replaces the one being published. The keys are at most three characters long, so that every message
+ * fits a single frame. The times are in milliseconds, the voltages in volts; op is 1 for turning on and 0 for turning
+ * off.
+ */
+void publishOperationReport()
+{
+    static const auto Priority = uavcan::TransferPriority::Lowest;
+
+    static uavcan::Publisher<uavcan::protocol::debug::KeyValue> pub(getNode());
+
+    static bool initialized = false;
+    if (!initialized)
+    {
+        initialized = true;
+        pub.setPriority(Priority);
+    }
+
+    static magnet::OperationReport report;
+    static unsigned next_metric_index = 0;
+
+    const auto& last_report = magnet::getLastOperationReport();
+    if (last_report.sequence != report.sequence)
+    {
+        report = last_report;
+        next_metric_index = 0;
+    }
+
+    const struct
+    {
+        const char* key;
+        float value;
+    } metrics[] =
+    {
+        { "op",  report.turn_on ? 1.0F : 0.0F },
+        { "err", report.failed ? 1.0F : 0.0F },
+        { "cyc", float(report.num_cycles) },
+        { "chg", float(report.mean_charge_time_ms) },
+        { "chx", float(report.max_charge_time_ms) },
+        { "seq", float(report.sequence_time_ms) },
+        { "vin", float(report.min_supply_voltage_mV) * 1e-3F },
+        { "bst", float(report.num_bursts) },
+        { "vpk", float(report.peak_output_voltage_V) }
+    };
+
+    if ((report.sequence != 0) && (next_metric_index < (sizeof(metrics) / sizeof(metrics[0]))))
+    {
+        uavcan::protocol::debug::KeyValue msg;
+        msg.key = metrics[next_metric_index].key;
+        msg.value = metrics[next_metric_index].value;
+        (void)pub.broadcast(msg);
+        next_metric_index++;
+    }
+}
+
 void updateCanLed(const uavcan::TimerEvent&)
 {
     board::setCanLed(uavcan_lpc11c24::CanDriver::instance().hadActivity());
@@ -356,30 +731,45 @@ __attribute__((noinline))
 #endif
 void init()
 {
-    board::syslog("Boot\r\n");
-    board::syslog("FW built at ");
-    board::syslog(__DATE__);
-    board::syslog("\r\n");
+    BOARD_SYSLOG("Boot\r\n");
+    BOARD_SYSLOG("FW built at ");
+    BOARD_SYSLOG(__DATE__);
+    BOARD_SYSLOG("\r\n");
     board::resetWatchdog();
 
+    // The parameters are needed before the magnet is polled for the first time
+    (void)board::tryReadPersistentConfig(persistent_config);
+    params::load(persistent_config);
+
     callPollAndResetWatchdog();
 
     /*
      * Configuring the CAN controller
+     * The bit rate and the node ID stored at the last boot are tried first, the detection and the allocation are
+     * only needed if they do not work.
      */
-    std::uint32_t bit_rate = 0;
-    while (bit_rate == 0)
+    std::uint32_t bit_rate = persistent_config.can_bit_rate;
+    const bool bit_rate_restored = (bit_rate > 0) && tryStoredBitRate(bit_rate);
+    if (bit_rate_restored)
     {
-        bit_rate = uavcan_lpc11c24::CanDriver::detectBitRate(&callPollAndResetWatchdog);
+        BOARD_SYSLOG("Bitrate restored\r\n");
     }
-    board::syslog("Bitrate: ", bit_rate, "\r\n");
-
-    if (uavcan_lpc11c24::CanDriver::instance().init(bit_rate) < 0)
+    else
     {
-        board::die();
+        bit_rate = 0;
+        while (bit_rate == 0)
+        {
+            bit_rate = uavcan_lpc11c24::CanDriver::detectBitRate(&callPollAndResetWatchdog);
+        }
+
+        if (uavcan_lpc11c24::CanDriver::instance().init(bit_rate) < 0)
+        {
+            board::die();
+        }
     }
+    BOARD_SYSLOG("Bitrate: ", bit_rate, "\r\n");
 
-    board::syslog("CAN init ok\r\n");
+    BOARD_SYSLOG("CAN init ok\r\n");
 
     callPollAndResetWatchdog();
 
@@ -413,25 +803,49 @@ void init()
 
     if (getHwConfig().use_hardpoint_id_as_node_id)
     {
-        board::syslog("Node ID is fixed\r\n");
+        BOARD_SYSLOG("Node ID is fixed\r\n");
         getNode().setNodeID(static_cast<std::uint8_t>(getHwConfig().hardpoint_id + HwConfig::NodeIDOffset));
     }
+    else if (bit_rate_restored &&           // Otherwise this is likely another bus
+             (persistent_config.node_id > 0) && (persistent_config.node_id <= uavcan::NodeID::Max))
+    {
+        BOARD_SYSLOG("Node ID restored\r\n");
+        getNode().setNodeID(persistent_config.node_id);
+        startNodeIDConflictMonitor();
+    }
     else
     {
-        board::syslog("Node ID allocation...\r\n");
+        BOARD_SYSLOG("Node ID allocation...\r\n");
         getNode().setNodeID(performDynamicNodeIDAllocation());
     }
 
-    board::syslog("Node ID ", getNode().getNodeID().get(), "\r\n");
+    BOARD_SYSLOG("Node ID ", getNode().getNodeID().get(), "\r\n");
+
+    // Nothing is written unless the bus has changed; the fixed node ID does not replace the allocated one
+    persistent_config.can_bit_rate = bit_rate;
+    if (!getHwConfig().use_hardpoint_id_as_node_id)
+    {
+        persistent_config.node_id = getNode().getNodeID().get();
+    }
+    if (!board::writePersistentConfig(persistent_config))
+    {
+        BOARD_SYSLOG("Config not stored\r\n");
+    }
 
     callPollAndResetWatchdog();
 
     /*
      * Initializing other libuavcan-related objects
      */
-    static uavcan::TimerEventForwarder<void (*)(const uavcan::TimerEvent&)> update_timer(getNode());    // Status pub
-    update_timer.setCallback(reinterpret_cast<decltype(update_timer)::Callback>(&updateUavcanStatus));
-    update_timer.startPeriodic(uavcan::MonotonicDuration::fromMSec(500));
+    getStatusTimer().setCallback(reinterpret_cast<StatusTimer::Callback>(&handleStatusTimer));           // Status pub
+    startStatusTimer();
+
+    static ParamManager param_manager;                                                                  // Param srv
+    static uavcan::ParamServer param_server(getNode());
+    if (param_server.start(&param_manager) < 0)
+    {
+        board::die();
+    }
 
     static uavcan::Subscriber<uavcan::equipment::hardpoint::Command,                                    // Command sub
                               void (*)(const uavcan::equipment::hardpoint::Command&)> command_sub(getNode());
@@ -444,6 +858,12 @@ void init()
      * Configuring the filters in the last order, when all subscribers are initialized.
      */
     configureAcceptanceFilters();
+
+#if HARDPOINT_FAST_PATH
+    board::enableHardpointCommandFastPath(
+        static_cast<std::uint16_t>(uavcan::equipment::hardpoint::Command::DefaultDataTypeID),
+        getHwConfig().hardpoint_id);
+#endif
 }
 
 }
@@ -456,16 +876,38 @@ int main()
 
     board::setStatusLed(false);
 
-    board::syslog("Init OK\r\n");
+    BOARD_SYSLOG("Init OK\r\n");
 
     while (true)
     {
-        const int res = getNode().spinOnce();
+        profiler::markLoopIteration();
+
+        // Polled first, so that a command latched by the CAN interrupt during the sleep is not delayed by libuavcan
+        {
+            profiler::ScopedSection section(profiler::Section::Poll);
+            callPollAndResetWatchdog();
+        }
+
+        int res = 0;
+        {
+            profiler::ScopedSection section(profiler::Section::Spin);
+            res = getNode().spinOnce();
+        }
         if (res < 0)
         {
-            board::syslog("Spin error ", res, "\r\n");
+            BOARD_SYSLOG("Spin error ", res, "\r\n");
         }
 
-        callPollAndResetWatchdog();
+        publishStatusOnChange();
+        publishOperationReport();
+        handleNodeIDConflict();
+        logCanStatsPeriodically();
+
+        // Nothing else can happen until an interrupt; libuavcan only has timers, which the wake-up timer covers
+        if (magnet::isIdle())
+        {
+            profiler::ScopedSection section(profiler::Section::Sleep);
+            board::sleepUntilInterrupt();
+        }
     }
 }
@@ -0,0 +1,128 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "params.hpp"
+#include <build_config.hpp>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+namespace params
+{
+namespace
+{
+/**
+ * No cycles are skipped with the standby precharge, see magnet::turnOff(); a non-zero value is rejected.
+ */
+constexpr unsigned TurnOffCyclesToSkipMax = build_config::StandbyPrecharge ? 0 : 10;
+
+/**
+ * The supply voltage readings never go below board::SupplyVoltageMinMillivolts, so a lower threshold would act
+ * the same as that minimum.
+ */
+constexpr unsigned VinMinMin_mV = std::max(build_config::VinMin_mV * 3U / 4U, board::SupplyVoltageMinMillivolts);
+
+/**
+ * The order must match Param. A larger inductance than the real one increases the peak primary current, so it
+ * is limited to +/-25%, and so is its product with the correction of the adaptive pump timing, see charger.cpp.
+ */
+constexpr Descriptor Descriptors[NumParams] =
+{
+    { "charger_timeout_ms",         build_config::ChargerTimeout_ms,        200,    2000 },
+    { "vin_min_mv",                 build_config::VinMin_mV,                VinMinMin_mV,   build_config::VinMax_mV },
+    { "reduced_current_voltage_mv", build_config::ReducedCurrentVoltage_mV, 0,      build_config::VinMax_mV },
+    { "pr_inductance_ph",           build_config::PRInductance_pH,          build_config::PRInductance_pH / 4U * 3U,
+                                                                            build_config::PRInductance_pH / 4U * 5U },
+    { "turn_off_cycles_to_skip",    TurnOffCyclesToSkipMax > 0 ? build_config::cycles_to_skip : 0,
+                                                                            0,      TurnOffCyclesToSkipMax },
+    { "status_period_ms",           500,                                    100,    2000 }
+};
+
+template <std::size_t... Indices>
+constexpr std::array<unsigned, sizeof...(Indices)> makeDefaults(std::index_sequence<Indices...>)
+{
+    return {{ Descriptors[Indices].default_value... }};
+}
+
+std::array<unsigned, NumParams> values = makeDefaults(std::make_index_sequence<NumParams>());
+
+bool isInRange(unsigned index, unsigned value)
+{
+    return (value >= Descriptors[index].min_value) && (value <= Descriptors[index].max_value);
+}
+
+}
+
+const Descriptor* getDescriptor(unsigned index)
+{
+    return (index < NumParams) ? &Descriptors[index] : nullptr;
+}
+
+unsigned findByName(const char* name)
+{
+    unsigned index = 0;
+    while ((index < NumParams) && (std::strcmp(Descriptors[index].name, name) != 0))
+    {
+        index++;
+    }
+    return index;
+}
+
+unsigned get(Param param)
+{
+    return values[static_cast<unsigned>(param)];
+}
+
+bool set(unsigned index, unsigned value)
+{
+    if ((index >= NumParams) || !isInRange(index, value))
+    {
+        return false;
+    }
+    values[index] = value;
+    return true;
+}
+
+void resetToDefaults()
+{
+    for (unsigned i = 0; i < NumParams; i++)
+    {
+        values[i] = Descriptors[i].default_value;
+    }
+}
+
+void load(const board::PersistentConfig& config)
+{
+    resetToDefaults();
+    for (unsigned i = 0; (i < NumParams) && (i < config.num_params); i++)
+    {
+        (void)set(i, config.params[i]);
+    }
+}
+
+void store(board::PersistentConfig& config)
+{
+    config.num_params = static_cast<std::uint8_t>(NumParams);
+    for (unsigned i = 0; i < NumParams; i++)
+    {
+        config.params[i] = values[i];
+    }
+}
+
+}
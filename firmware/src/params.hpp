@@ -0,0 +1,81 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Parameters that can be tuned at run time, e.g. for the power rail of a particular unit, via the UAVCAN
+ * parameter service (see main.cpp). The defaults come from build_config.hpp; the values are stored in the flash
+ * together with the persistent config of the board, see board::PersistentConfig.
+ */
+
+#pragma once
+
+#include <sys/board.hpp>
+#include <cstdint>
+
+namespace params
+{
+
+enum class Param : std::uint8_t
+{
+    ChargerTimeoutMSec,                 ///< build_config::ChargerTimeout_ms
+    VinMinMillivolts,                   ///< build_config::VinMin_mV, the undervoltage error threshold
+    ReducedCurrentVoltageMillivolts,    ///< build_config::ReducedCurrentVoltage_mV, zero disables the reduction
+    PRInductancePicohenries,            ///< build_config::PRInductance_pH, scales the pump timing
+    TurnOffCyclesToSkip,                ///< build_config::cycles_to_skip, always zero with the standby precharge
+    StatusPeriodMSec,                   ///< Period of the hardpoint status publication
+    NumParams
+};
+
+static constexpr unsigned NumParams = static_cast<unsigned>(Param::NumParams);
+
+static_assert(NumParams <= board::PersistentConfig::MaxParams, "The parameters do not fit the persistent config");
+
+struct Descriptor
+{
+    const char* name;
+    unsigned default_value;
+    unsigned min_value;
+    unsigned max_value;
+};
+
+/**
+ * Returns nullptr if the index is out of range.
+ */
+const Descriptor* getDescriptor(unsigned index);
+
+/**
+ * Returns the index of the parameter, or NumParams if there is no parameter with this name.
+ */
+unsigned findByName(const char* name);
+
+unsigned get(Param param);
+
+/**
+ * Returns false, and leaves the value unchanged, if the value is out of range.
+ */
+bool set(unsigned index, unsigned value);
+
+void resetToDefaults();
+
+/**
+ * The stored values that are out of range, e.g. after the ranges have been changed by a firmware update,
+ * are replaced with the defaults.
+ */
+void load(const board::PersistentConfig& config);
+
+void store(board::PersistentConfig& config);
+
+}
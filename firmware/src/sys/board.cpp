@@ -22,7 +22,10 @@
  */
 
 #include "board.hpp"
+#include "profiler.hpp"
+#include <build_config.hpp>
 #include <chip.h>
+#include <ring_buffer.h>
 #include <cstdlib>
 #include <cstring>
 #include <numeric>
@@ -48,6 +51,7 @@ constexpr std::uint32_t TargetSystemCoreClock = 48000000;
 
 constexpr unsigned AdcReferenceMillivolts = 3300;
 constexpr unsigned AdcResolutionBits = 10;
+constexpr unsigned SupplyDividerRatioQ16 = 364380;      ///< 5.56 * 2^16, rounded down
 
 constexpr unsigned PwmPortNum = 2;
 constexpr unsigned PwmInputPinMask = 1U << 10;
@@ -64,7 +68,29 @@ constexpr unsigned StatusLedPortNum = 2;
 constexpr unsigned StatusLedPinMask = 1U << 0;
 
 constexpr unsigned PumpSwitchPortNum = 1;
+#if PUMP_TIMER
+constexpr unsigned PumpSwitchPinMask = 1U << 0;         // The other switches are driven by the timer
+#else
 constexpr unsigned PumpSwitchPinMask = (1U << 0) | (1U << 1) | (1U << 2) | (1U << 4);
+#endif
+
+#if PUMP_TIMER
+/*
+ * The pump switches are driven by the PWM outputs of CT32B1: MAT0 (PIO1_1), MAT1 (PIO1_2), MAT3 (PIO1_4).
+ * MR2 defines the switching period; each period starts with the off phase, and the outputs are cleared when the
+ * period ends. PIO1_0 has no match output, so its switch is not used, and the pin is left as an input with
+ * pull-down in order not to fight the other outputs; the on time is reduced accordingly, see build_config.
+ * CT16B1 measures the length of the burst and stops CT32B1 at the end of the last period.
+ */
+constexpr unsigned PumpTimerPwmMask = (1U << 0) | (1U << 1) | (1U << 3);
+constexpr std::uint8_t PumpTimerPeriodMatch = 2;
+constexpr std::uint8_t PumpGateMatch = 0;
+
+constexpr std::uint32_t nsToPumpTimerTicks(std::uint32_t ns)
+{
+    return (ns * (TargetSystemCoreClock / 1000000U) + 500U) / 1000U;
+}
+#endif
 
 constexpr unsigned MagnetCtrlPortNum = 2;
 constexpr unsigned MagnetCtrlPinMask23 = (1U << 1) | (1U << 7);
@@ -73,11 +99,180 @@ constexpr unsigned MagnetCtrlPinMask14 = (1U << 2) | (1U << 8);
 constexpr unsigned DipSwitchPortNum = 3;
 constexpr unsigned DipSwitchPinMask = 0b1111;
 
+/*
+ * The persistent config takes the 256-byte pages of the last flash sector below the device signature, one page per
+ * write, since a page is the smallest block the IAP can program; the linker script keeps the firmware out of the
+ * sector. Once all pages are used, the sector is erased, the page of the signature is programmed back, and the writes
+ * start over from the first page. The last valid record is the current config.
+ */
+constexpr unsigned FlashSize = 32768;
+constexpr unsigned FlashSectorSize = 4096;
+constexpr unsigned DeviceSignatureAddress = FlashSize - std::tuple_size<DeviceSignature>::value;
+constexpr unsigned ConfigSector = FlashSize / FlashSectorSize - 1U;
+constexpr unsigned ConfigSectorAddress = ConfigSector * FlashSectorSize;
+constexpr unsigned ConfigPageSize = 256;
+constexpr unsigned SignaturePageAddress = DeviceSignatureAddress / ConfigPageSize * ConfigPageSize;
+constexpr unsigned ConfigNumPages = (SignaturePageAddress - ConfigSectorAddress) / ConfigPageSize;
+constexpr unsigned ConfigRecordMagic = 0x32504547;          ///< "GEP2", the records without parameters are ignored
+
+struct ConfigRecord
+{
+    unsigned magic;
+    unsigned can_bit_rate;
+    unsigned node_id;
+    unsigned num_params;
+    unsigned params[PersistentConfig::MaxParams];
+    unsigned check;         ///< Inverted XOR of the fields above, so that a partially programmed record is rejected
+
+    unsigned computeCheck() const
+    {
+        unsigned x = magic ^ can_bit_rate ^ node_id ^ num_params;
+        for (auto p : params)
+        {
+            x ^= p;
+        }
+        return ~x;
+    }
+};
+
+static_assert(sizeof(ConfigRecord) <= ConfigPageSize, "Config record does not fit the page");
+
+constexpr unsigned IapCommandPrepareSectors = 50;
+constexpr unsigned IapCommandCopyRamToFlash = 51;
+constexpr unsigned IapCommandEraseSectors = 52;
+constexpr unsigned IapStatusSuccess = 0;
+
+/*
+ * The CAN controller is configured by the libuavcan driver, except for the bit rate probe that precedes it.
+ * The probe uses 8 to 16 time quanta per bit, with the sample point at about 87.5%.
+ */
+constexpr unsigned CanCntlOffset      = 0x000;
+constexpr unsigned CanStatOffset      = 0x004;
+constexpr unsigned CanBtOffset        = 0x00C;
+constexpr unsigned CanTestOffset      = 0x014;
+constexpr unsigned CanBrpeOffset      = 0x018;
+constexpr unsigned CanClkDivOffset    = 0x180;
+constexpr unsigned CanCntlInit        = 1U << 0;
+constexpr unsigned CanCntlCce         = 1U << 6;
+constexpr unsigned CanCntlTest        = 1U << 7;
+constexpr unsigned CanStatRxOk        = 1U << 4;
+constexpr unsigned CanStatLecNoChange = 7;      ///< Written to the last error code, so that the CPU can see updates
+constexpr unsigned CanTestSilent      = 1U << 3;
+constexpr unsigned CanMaxPrescaler    = 1024;
+constexpr unsigned CanMaxQuantaPerBit = 16;
+constexpr unsigned CanMinQuantaPerBit = 8;
+
+#if HARDPOINT_FAST_PATH
+/*
+ * The received frames are copied through the message interface 2 without clearing NEWDAT and INTPND, so the driver
+ * still gets them. The interface may be in use by the interrupted code, hence its registers are restored afterwards.
+ * UAVCAN message frames only: 29 bit ID, data type ID in the bits 8..23, the service flag in the bit 7, and the tail
+ * byte with the start and end of transfer flags set for a single frame. The mailbox is a single word, so the command
+ * and the flag are always written together.
+ */
+constexpr unsigned CanNewDat1Offset     = 0x120;        ///< Message objects 1..16, the next register 17..32
+constexpr unsigned CanNewDat2Offset     = 0x124;
+constexpr unsigned CanIf2CmdReqOffset   = 0x080;
+constexpr unsigned CanIf2CmdMskOffset   = 0x084;
+constexpr unsigned CanIf2Arb1Offset     = 0x090;
+constexpr unsigned CanIf2Arb2Offset     = 0x094;
+constexpr unsigned CanIf2MctrlOffset    = 0x098;
+constexpr unsigned CanIf2Da1Offset      = 0x09C;
+constexpr unsigned CanIf2Da2Offset      = 0x0A0;
+constexpr unsigned CanNumMessageObjects = 32;
+constexpr unsigned CanIfCmdReqBusy      = 1U << 15;
+constexpr unsigned CanIfCmdMskRead      = (1U << 5) | (1U << 4) | (1U << 1);     ///< Arbitration, control, data A
+constexpr unsigned CanIfArb2MsgVal      = 1U << 15;
+constexpr unsigned CanIfArb2Xtd         = 1U << 14;
+constexpr unsigned CanIfArb2Dir         = 1U << 13;
+constexpr unsigned CanIfMctrlNewDat     = 1U << 15;
+constexpr unsigned CanIfMctrlDlcMask    = 0xF;
+
+constexpr unsigned HardpointCommandFrameLength = 4;         ///< Hardpoint ID, command (LE16), tail byte
+constexpr unsigned UavcanServiceFlag = 1U << 7;
+constexpr unsigned UavcanTailSingleFrameMask = 0xE0;        ///< Start of transfer, end of transfer, toggle
+constexpr unsigned UavcanTailSingleFrame = 0xC0;
+
+constexpr std::uint32_t HardpointCommandLatched = 1U << 16;
+
+static bool hardpoint_fast_path_enabled;
+static std::uint16_t hardpoint_fast_path_data_type_id;
+static std::uint8_t hardpoint_fast_path_hardpoint_id;
+static volatile std::uint32_t hardpoint_command_mailbox;   ///< Command and HardpointCommandLatched, or zero
+#endif
+
+/*
+ * PIO2_10 has no timer capture function, so the edges are timestamped by reading the free-running CT32B0
+ * at the entry of the pin interrupt, which has the highest priority. The timer counts microseconds.
+ * A pulse takes effect only once PwmInputMinConsistentPulses pulses in a row are classified the same way.
+ */
 constexpr std::uint32_t PwmInputPeriodMinUSec = 500;
 constexpr std::uint32_t PwmInputPeriodMaxUSec = 2500;
 constexpr std::uint32_t PwmInputTimeoutUSec   = 100000;
-static std::uint32_t pwm_input_pulse_usec;
-static uavcan::MonotonicTime last_pwm_input_update_ts;
+constexpr std::uint32_t PwmInputLowMaxUSec    = 1250;
+constexpr std::uint32_t PwmInputHighMinUSec   = 1750;
+constexpr std::uint8_t PwmInputMinConsistentPulses = 2;
+static volatile std::uint32_t pwm_input_pulse_usec;
+static volatile std::uint32_t last_pwm_input_update_usec;
+
+/*
+ * The button shares the pin with the status LED and is readable only while the LED is off, i.e. the pin is an input.
+ * The edges are timestamped by the pin interrupt like the PWM input; a press is counted on release, if the pin
+ * has been high for at least ButtonMinPressUSec since the last rising edge, so the contact bounce is ignored.
+ */
+constexpr std::uint32_t ButtonMinPressUSec = 20000;
+static_assert(StatusLedPortNum == PwmPortNum, "The button and the PWM input share the pin interrupt");
+static volatile bool button_pressed;
+static volatile std::uint32_t button_pressed_at_usec;
+static volatile std::uint8_t button_press_events;
+
+/*
+ * Both ADC channels are converted continuously in the burst mode; the interrupt of the last channel of each scan
+ * replaces the oldest scan of the filter and updates the running sums, so that the readings are O(1). The filter
+ * starts zeroed, so the oldest scan can be subtracted before the filter is full. The interrupt runs at 10 kHz,
+ * hence the index-masked array instead of the generic ring buffer.
+ */
+constexpr unsigned AdcChannelsPerScan = 2;
+constexpr unsigned AdcFilterLengthLog2 = 3;
+constexpr unsigned AdcFilterLength = 1U << AdcFilterLengthLog2;     ///< Power of 2, so that the index wraps by masking
+
+struct AdcScan
+{
+    std::uint16_t supply;
+    std::uint16_t output;
+};
+
+static AdcScan adc_scans[AdcFilterLength];
+static unsigned adc_oldest_scan_index;
+static volatile std::uint32_t adc_supply_sum;
+static volatile std::uint32_t adc_output_sum;
+static volatile std::uint32_t adc_scan_count;
+static bool adc_paused;                                     ///< See sleepUntilInterrupt()
+
+/*
+ * The sleep is limited by a match interrupt of the free-running CT32B0, armed for a single shot before each sleep.
+ */
+constexpr std::uint8_t IdleWakeupMatch = 0;
+
+static std::uint8_t syslog_storage[SyslogBufferSize];
+static RINGBUFF_T syslog_buffer;
+static std::uint32_t syslog_dropped_messages;
+
+#if TOKENIZED_SYSLOG
+/*
+ * Binary syslog record, decoded by tools/syslog_decode.py:
+ *   sync, payload length, token (LE16), timestamp in milliseconds (LE16), payload, checksum
+ * The token is the offset of the text in .syslog_dict. The payload is the integer value as a zigzag varint, or the
+ * text itself for SyslogTextToken. The checksum is the XOR of all bytes after the sync byte.
+ */
+constexpr std::uint8_t SyslogRecordSync = 0xA5;
+constexpr std::uint16_t SyslogTextToken = 0xFFFF;           ///< Not a valid offset, the dictionary is smaller
+constexpr unsigned SyslogRecordOverhead = 7;
+constexpr unsigned SyslogMaxPayloadLength = 48;             ///< Longer texts are truncated
+#endif
+
+static volatile unsigned pump_stop_voltage;
+static volatile bool pump_stop_voltage_reached;
 
 struct CriticalSectionLocker
 {
@@ -118,9 +313,15 @@ constexpr PinMuxGroup pinmux[] =
 #endif
 
     { IOCON_PIO1_0,  IOCON_FUNC1 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW0
+#if PUMP_TIMER
+    { IOCON_PIO1_1,  IOCON_FUNC3 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW1 CT32B1_MAT0
+    { IOCON_PIO1_2,  IOCON_FUNC3 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW2 CT32B1_MAT1
+    { IOCON_PIO1_4,  IOCON_FUNC2 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW4 CT32B1_MAT3
+#else
     { IOCON_PIO1_1,  IOCON_FUNC1 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW1
     { IOCON_PIO1_2,  IOCON_FUNC1 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW2
     { IOCON_PIO1_4,  IOCON_FUNC0 | IOCON_MODE_PULLDOWN | IOCON_HYS_EN | IOCON_DIGMODE_EN },     // PUMP SW4
+#endif
 
     // PIO2
     { IOCON_PIO2_0,  IOCON_FUNC0 | IOCON_HYS_EN | IOCON_MODE_PULLDOWN },                        // Status LED
@@ -243,36 +444,81 @@ void initGpio()
 
     gpio::makeOutputsAndSet(CanLedPortNum, CanLedPinMask, 0);
 
+#if PUMP_TIMER
+    gpio::makeInputs(PumpSwitchPortNum, PumpSwitchPinMask);
+#else
     gpio::makeOutputsAndSet(PumpSwitchPortNum, PumpSwitchPinMask, 0);
+#endif
 
     gpio::makeOutputsAndSet(MagnetCtrlPortNum, MagnetCtrlPinMask23 | MagnetCtrlPinMask14, 0);
 
     // PWM input config
+    LPC_SYSCTL->SYSAHBCLKCTRL |= 1 << SYSCTL_CLOCK_CT32B0;
+    LPC_TIMER32_0->TCR = TIMER_RESET;
+    LPC_TIMER32_0->PR = TargetSystemCoreClock / 1000000U - 1U;
+    LPC_TIMER32_0->TCR = TIMER_ENABLE;
+
     // IBE must be configured in the IRQ handler because of the hardware bug (long story TODO document later)
-    LPC_GPIO[PwmPortNum].IE  = PwmInputPinMask;
-    LPC_GPIO[PwmPortNum].IC  = PwmInputPinMask;
+    LPC_GPIO[PwmPortNum].IE  = PwmInputPinMask | StatusLedPinMask;
+    LPC_GPIO[PwmPortNum].IC  = PwmInputPinMask | StatusLedPinMask;
     NVIC_EnableIRQ(EINT2_IRQn);
     NVIC_SetPriority(EINT2_IRQn, 0);    // Highest
+
+    NVIC_EnableIRQ(TIMER_32_0_IRQn);
+    NVIC_SetPriority(TIMER_32_0_IRQn, 3);   // Only wakes the core
 }
 
 void initAdc()
 {
-    constexpr unsigned SamplesPerSecond = 1000;
-
     auto clock = ::ADC_CLOCK_SETUP_T();
     Chip_ADC_Init(LPC_ADC, &clock);
 
-    Chip_ADC_SetSampleRate(LPC_ADC, &clock, SamplesPerSecond);
+    Chip_ADC_SetSampleRate(LPC_ADC, &clock, AdcScansPerSecond * AdcChannelsPerScan);
     Chip_ADC_EnableChannel(LPC_ADC, ADC_CH6, ENABLE);       // Vin
     Chip_ADC_EnableChannel(LPC_ADC, ADC_CH0, ENABLE);       // Vout
+
+    // Channels are converted in ascending order, so CH6 completes the scan
+    Chip_ADC_Int_SetGlobalCmd(LPC_ADC, DISABLE);
+    Chip_ADC_Int_SetChannelCmd(LPC_ADC, ADC_CH6, ENABLE);
+    NVIC_EnableIRQ(ADC_IRQn);
+    NVIC_SetPriority(ADC_IRQn, 1);          // Below the pump timer and the PWM input
+
     Chip_ADC_SetBurstCmd(LPC_ADC, ENABLE);
+
+    // Filling the filter, otherwise the first readings would be too low
+    while (adc_scan_count < AdcFilterLength) { }
+}
+
+#if PUMP_TIMER
+void initPumpTimer()
+{
+    LPC_SYSCTL->SYSAHBCLKCTRL |= 1 << SYSCTL_CLOCK_CT32B1;
+    LPC_SYSCTL->SYSAHBCLKCTRL |= 1 << SYSCTL_CLOCK_CT16B1;
+
+    LPC_TIMER32_1->TCR = TIMER_RESET;
+    LPC_TIMER32_1->PR = 0;
+    LPC_TIMER32_1->EMR = 0;
+    LPC_TIMER32_1->PWMC = PumpTimerPwmMask;
+
+    LPC_TIMER16_1->TCR = TIMER_RESET;
+    LPC_TIMER16_1->MCR = TIMER_INT_ON_MATCH(PumpGateMatch) | TIMER_STOP_ON_MATCH(PumpGateMatch);
+
+    NVIC_EnableIRQ(TIMER_16_1_IRQn);
+    NVIC_SetPriority(TIMER_16_1_IRQn, 0);   // Highest, a late interrupt adds an extra period to the burst
 }
+#endif
 
 void initUart()
 {
     Chip_UART_Init(LPC_USART);
     Chip_UART_SetBaud(LPC_USART, 115200);
     Chip_UART_TXEnable(LPC_USART);
+
+    (void)RingBuffer_Init(&syslog_buffer, &syslog_storage[0], 1, SyslogBufferSize);
+
+    // The transmit interrupt is enabled by Chip_UART_SendRB() and disabled when the buffer is empty
+    NVIC_EnableIRQ(UART0_IRQn);
+    NVIC_SetPriority(UART0_IRQn, 3);        // Nothing depends on its latency
 }
 
 void init()
@@ -289,10 +535,299 @@ void init()
     initGpio();
     initAdc();
     initUart();
+#if PUMP_TIMER
+    initPumpTimer();
+#endif
 
     resetWatchdog();
 }
 
+void enqueueSyslog(const void* data, unsigned len)
+{
+    // The interrupt only frees space, so the message cannot be truncated after this check
+    if (static_cast<unsigned>(RingBuffer_GetFree(&syslog_buffer)) < len)
+    {
+        syslog_dropped_messages++;
+        return;
+    }
+
+    (void)Chip_UART_SendRB(LPC_USART, &syslog_buffer, data, static_cast<int>(len));
+}
+
+#if TOKENIZED_SYSLOG
+void sendSyslogRecord(std::uint16_t token, const std::uint8_t* payload, unsigned payload_len)
+{
+    payload_len = std::min(payload_len, SyslogMaxPayloadLength);
+    const auto timestamp = static_cast<std::uint16_t>(clock::getMonotonic().toMSec());
+
+    std::uint8_t record[SyslogRecordOverhead + SyslogMaxPayloadLength];
+    record[0] = SyslogRecordSync;
+    record[1] = static_cast<std::uint8_t>(payload_len);
+    record[2] = static_cast<std::uint8_t>(token);
+    record[3] = static_cast<std::uint8_t>(token >> 8);
+    record[4] = static_cast<std::uint8_t>(timestamp);
+    record[5] = static_cast<std::uint8_t>(timestamp >> 8);
+    if (payload_len > 0)
+    {
+        std::memcpy(&record[6], payload, payload_len);
+    }
+
+    std::uint8_t checksum = 0;
+    for (unsigned i = 1; i < payload_len + 6U; i++)
+    {
+        checksum ^= record[i];
+    }
+    record[payload_len + 6U] = checksum;
+
+    enqueueSyslog(&record[0], payload_len + SyslogRecordOverhead);
+}
+#endif
+
+volatile std::uint32_t& canRegister(unsigned offset)
+{
+    return *reinterpret_cast<volatile std::uint32_t*>(LPC_CAN0_BASE + offset);
+}
+
+#if HARDPOINT_FAST_PATH
+/**
+ * Returns true and the command if the message object holds a new hardpoint command addressed to this hardpoint.
+ */
+bool peekHardpointCommand(unsigned msg_obj, std::uint16_t& out_command)
+{
+    canRegister(CanIf2CmdMskOffset) = CanIfCmdMskRead;
+    canRegister(CanIf2CmdReqOffset) = msg_obj;
+    while ((canRegister(CanIf2CmdReqOffset) & CanIfCmdReqBusy) != 0)
+    {
+        ;
+    }
+
+    const unsigned arb2 = canRegister(CanIf2Arb2Offset);
+    const unsigned mctrl = canRegister(CanIf2MctrlOffset);
+    if (((arb2 & (CanIfArb2MsgVal | CanIfArb2Xtd | CanIfArb2Dir)) != (CanIfArb2MsgVal | CanIfArb2Xtd)) ||
+        ((mctrl & CanIfMctrlNewDat) == 0) ||
+        ((mctrl & CanIfMctrlDlcMask) != HardpointCommandFrameLength))
+    {
+        return false;           // Transmit object, or not a hardpoint command
+    }
+
+    const unsigned can_id = ((arb2 & 0x1FFFU) << 16) | (canRegister(CanIf2Arb1Offset) & 0xFFFFU);
+    if (((can_id & UavcanServiceFlag) != 0) || (((can_id >> 8) & 0xFFFFU) != hardpoint_fast_path_data_type_id))
+    {
+        return false;
+    }
+
+    const unsigned data_a = canRegister(CanIf2Da1Offset);       // Bytes 0 and 1
+    const unsigned data_b = canRegister(CanIf2Da2Offset);       // Bytes 2 and 3
+    if (((data_a & 0xFFU) != hardpoint_fast_path_hardpoint_id) ||
+        (((data_b >> 8) & UavcanTailSingleFrameMask) != UavcanTailSingleFrame))
+    {
+        return false;
+    }
+
+    out_command = static_cast<std::uint16_t>(((data_a >> 8) & 0xFFU) | ((data_b & 0xFFU) << 8));
+    return true;
+}
+
+/**
+ * Called from the CAN interrupt before the driver. All message objects holding new data are checked, not only the
+ * one that raised the interrupt, since the driver may take several frames per interrupt.
+ */
+void latchHardpointCommand()
+{
+    std::uint32_t new_data = (canRegister(CanNewDat1Offset) & 0xFFFFU) |
+                             ((canRegister(CanNewDat2Offset) & 0xFFFFU) << 16);
+    if (!hardpoint_fast_path_enabled || (new_data == 0))
+    {
+        return;                 // Status interrupt, or the frames are transmitted
+    }
+
+    while ((canRegister(CanIf2CmdReqOffset) & CanIfCmdReqBusy) != 0)
+    {
+        ;
+    }
+    const std::uint32_t saved_cmd_msk = canRegister(CanIf2CmdMskOffset);
+    const std::uint32_t saved_arb1    = canRegister(CanIf2Arb1Offset);
+    const std::uint32_t saved_arb2    = canRegister(CanIf2Arb2Offset);
+    const std::uint32_t saved_mctrl   = canRegister(CanIf2MctrlOffset);
+    const std::uint32_t saved_da1     = canRegister(CanIf2Da1Offset);
+    const std::uint32_t saved_da2     = canRegister(CanIf2Da2Offset);
+
+    for (unsigned msg_obj = 1; (msg_obj <= CanNumMessageObjects) && (new_data != 0); msg_obj++, new_data >>= 1)
+    {
+        std::uint16_t command = 0;
+        if (((new_data & 1U) != 0) && peekHardpointCommand(msg_obj, command))
+        {
+            hardpoint_command_mailbox = HardpointCommandLatched | command;
+            break;
+        }
+    }
+
+    canRegister(CanIf2CmdMskOffset) = saved_cmd_msk;
+    canRegister(CanIf2Arb1Offset)   = saved_arb1;
+    canRegister(CanIf2Arb2Offset)   = saved_arb2;
+    canRegister(CanIf2MctrlOffset)  = saved_mctrl;
+    canRegister(CanIf2Da1Offset)    = saved_da1;
+    canRegister(CanIf2Da2Offset)    = saved_da2;
+}
+#endif
+
+#if __GNUC__
+__attribute__((optimize(0)))     // Like readUniqueID()
+#endif
+unsigned callIap(unsigned (&command)[5])
+{
+    unsigned result[5] = {};
+    iap_entry(command, result);
+    return result[0];
+}
+
+/**
+ * Returns the address of the first blank page of the config sector, or zero if there are none left.
+ */
+unsigned findBlankConfigPage()
+{
+    for (unsigned i = 0; i < ConfigNumPages; i++)
+    {
+        const unsigned page = ConfigSectorAddress + i * ConfigPageSize;
+        const auto words = reinterpret_cast<const std::uint32_t*>(page);
+        if (std::all_of(words, words + ConfigPageSize / 4U, [](std::uint32_t x) { return x == 0xFFFFFFFFU; }))
+        {
+            return page;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Programs a page from a word aligned buffer, the interrupts are disabled for about a millisecond meanwhile.
+ */
+bool programFlashPage(unsigned address, const std::uint32_t (&page)[ConfigPageSize / 4U])
+{
+    // The sector is locked again after every erase or write, hence it is prepared before each of them
+    unsigned prepare_command[5] = { IapCommandPrepareSectors, ConfigSector, ConfigSector, 0, 0 };
+    unsigned copy_command[5] = {
+        IapCommandCopyRamToFlash,
+        address,
+        static_cast<unsigned>(reinterpret_cast<std::uintptr_t>(&page[0])),
+        ConfigPageSize,
+        TargetSystemCoreClock / 1000U           // kHz
+    };
+
+    // The flash cannot be read while it is being programmed, the vector table included
+    CriticalSectionLocker locker;
+    return (callIap(prepare_command) == IapStatusSuccess) && (callIap(copy_command) == IapStatusSuccess);
+}
+
+/**
+ * Erases the config sector and programs the device signature back; the erase takes about 100 ms with the interrupts
+ * disabled. A power loss before the signature is programmed back loses it.
+ */
+bool eraseConfigSector()
+{
+    DeviceSignature signature;
+    const bool have_signature = tryReadDeviceSignature(signature);
+
+    unsigned prepare_command[5] = { IapCommandPrepareSectors, ConfigSector, ConfigSector, 0, 0 };
+    unsigned erase_command[5] = {
+        IapCommandEraseSectors,
+        ConfigSector,
+        ConfigSector,
+        TargetSystemCoreClock / 1000U,          // kHz
+        0
+    };
+    {
+        CriticalSectionLocker locker;
+        if ((callIap(prepare_command) != IapStatusSuccess) || (callIap(erase_command) != IapStatusSuccess))
+        {
+            return false;
+        }
+    }
+
+    if (!have_signature)
+    {
+        return true;
+    }
+    std::uint32_t page_buffer[ConfigPageSize / 4U];
+    std::fill(std::begin(page_buffer), std::end(page_buffer), 0xFFFFFFFFU);
+    std::memcpy(reinterpret_cast<std::uint8_t*>(&page_buffer[0]) + (DeviceSignatureAddress - SignaturePageAddress),
+                signature.data(), signature.size());
+    return programFlashPage(SignaturePageAddress, page_buffer);
+}
+
+bool programConfigPage(unsigned address, const PersistentConfig& config)
+{
+    ConfigRecord record;
+    record.magic = ConfigRecordMagic;
+    record.can_bit_rate = config.can_bit_rate;
+    record.node_id = config.node_id;
+    record.num_params = config.num_params;
+    std::copy(config.params.begin(), config.params.end(), std::begin(record.params));
+    record.check = record.computeCheck();
+
+    std::uint32_t page_buffer[ConfigPageSize / 4U];     // The IAP requires a word aligned source
+    std::fill(std::begin(page_buffer), std::end(page_buffer), 0xFFFFFFFFU);
+    std::memcpy(&page_buffer[0], &record, sizeof(record));
+
+    return programFlashPage(address, page_buffer);
+}
+
+PwmInput classifyPwmPulse(std::uint32_t pulse_usec)
+{
+    if (pulse_usec == 0)
+    {
+        return PwmInput::NoSignal;
+    }
+    else if (pulse_usec < PwmInputLowMaxUSec)
+    {
+        return PwmInput::Low;
+    }
+    else if (pulse_usec > PwmInputHighMinUSec)
+    {
+        return PwmInput::High;
+    }
+    else
+    {
+        return PwmInput::Neutral;
+    }
+}
+
+/**
+ * Reading the data register of the last channel clears the interrupt.
+ */
+AdcScan readAdcScan()
+{
+    return {
+        static_cast<std::uint16_t>(ADC_DR_RESULT(LPC_ADC->DR[ADC_CH6])),
+        static_cast<std::uint16_t>(ADC_DR_RESULT(LPC_ADC->DR[ADC_CH0]))
+    };
+}
+
+/**
+ * Resumes the ADC interrupt paused by sleepUntilInterrupt(). The conversions keep running during the sleep, so the
+ * data registers hold the latest scan, and the filter is seeded with it instead of waiting for AdcFilterLength fresh
+ * scans; the next scans replace the seed as usual. The pump is not running during the sleep, so there is no switching
+ * noise to filter out. The interrupt is still disabled while seeding, so nothing is waited for, and the function is
+ * safe to call with the interrupts masked.
+ */
+void resumeAdc()
+{
+    if (adc_paused)
+    {
+        adc_paused = false;
+
+        const AdcScan scan = readAdcScan();
+        for (auto& x : adc_scans)
+        {
+            x = scan;
+        }
+        adc_supply_sum = scan.supply * AdcFilterLength;
+        adc_output_sum = scan.output * AdcFilterLength;
+
+        NVIC_ClearPendingIRQ(ADC_IRQn);
+        NVIC_EnableIRQ(ADC_IRQn);
+    }
+}
+
 } // namespace
 
 void die()
@@ -300,6 +835,11 @@ void die()
     while (true) { }
 }
 
+void restart()
+{
+    NVIC_SystemReset();
+}
+
 #if __GNUC__
 __attribute__((optimize(0)))     // Optimization must be disabled lest it hardfaults in the IAP call
 #endif
@@ -313,10 +853,8 @@ void readUniqueID(UniqueID& out_uid)
 
 bool tryReadDeviceSignature(DeviceSignature& out_signature)
 {
-    static const unsigned SignatureAddress = 32768 - std::tuple_size<DeviceSignature>::value; // End of flash
-
     std::memcpy(out_signature.data(),
-                reinterpret_cast<void*>(SignatureAddress),
+                reinterpret_cast<void*>(DeviceSignatureAddress),
                 std::tuple_size<DeviceSignature>::value);
 
     for (auto x : out_signature)
@@ -329,6 +867,142 @@ bool tryReadDeviceSignature(DeviceSignature& out_signature)
     return false;       // All bytes contain 0xFF, means that the memory is empty
 }
 
+bool tryReadPersistentConfig(PersistentConfig& out_config)
+{
+    bool found = false;
+
+    // Blank and partially programmed pages are skipped, the latter are left behind by a power loss while writing
+    for (unsigned i = 0; i < ConfigNumPages; i++)
+    {
+        ConfigRecord record;
+        std::memcpy(&record, reinterpret_cast<void*>(ConfigSectorAddress + i * ConfigPageSize), sizeof(record));
+
+        if ((record.magic == ConfigRecordMagic) && (record.check == record.computeCheck()))
+        {
+            out_config.can_bit_rate = record.can_bit_rate;
+            out_config.node_id = static_cast<std::uint8_t>(record.node_id);
+            out_config.num_params = static_cast<std::uint8_t>(
+                (record.num_params < PersistentConfig::MaxParams) ? record.num_params : PersistentConfig::MaxParams);
+            std::copy(std::begin(record.params), std::end(record.params), out_config.params.begin());
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+bool writePersistentConfig(const PersistentConfig& config)
+{
+    PersistentConfig stored;
+    const bool have_stored = tryReadPersistentConfig(stored);
+    if (have_stored && (stored == config))
+    {
+        return true;
+    }
+
+    unsigned address = findBlankConfigPage();
+    const bool erase_sector = address == 0;
+    if (erase_sector)
+    {
+        address = ConfigSectorAddress;
+    }
+
+    PersistentConfig written;
+    if ((!erase_sector || eraseConfigSector()) && programConfigPage(address, config) &&
+        tryReadPersistentConfig(written) && (written == config))
+    {
+        return true;
+    }
+
+    /*
+     * A failed write to a blank page leaves the previous record in effect, since the reader skips the partially
+     * programmed pages. Past the erase the previous record is gone, so it is put back from RAM.
+     */
+    if (erase_sector && have_stored)
+    {
+        const unsigned fallback_address = findBlankConfigPage();
+        if (fallback_address != 0)
+        {
+            (void)programConfigPage(fallback_address, stored);
+        }
+    }
+    return false;
+}
+
+bool startCanBitRateProbe(std::uint32_t bit_rate)
+{
+    unsigned quanta = CanMaxQuantaPerBit;
+    while ((quanta >= CanMinQuantaPerBit) && ((bit_rate == 0) || ((TargetSystemCoreClock % (bit_rate * quanta)) != 0)))
+    {
+        quanta--;
+    }
+    if (quanta < CanMinQuantaPerBit)
+    {
+        return false;
+    }
+    const unsigned prescaler = TargetSystemCoreClock / (bit_rate * quanta);
+    if (prescaler > CanMaxPrescaler)
+    {
+        return false;
+    }
+    const unsigned tseg2 = std::max(1U, (quanta + 4U) / 8U);
+    const unsigned tseg1 = quanta - 1U - tseg2;
+
+    LPC_SYSCTL->SYSAHBCLKCTRL |= 1 << SYSCTL_CLOCK_CAN;
+    Chip_SYSCTL_PeriphReset(RESET_CAN0);
+
+    volatile std::uint32_t& cntl = canRegister(CanCntlOffset);
+
+    // The silent mode is entered before the initialization state is left, so the controller never drives the bus
+    cntl = CanCntlInit | CanCntlCce;
+    canRegister(CanClkDivOffset) = 0;           // The CAN clock is the system clock
+    canRegister(CanBtOffset) = ((prescaler - 1U) & 0x3FU) | ((tseg1 - 1U) << 8) | ((tseg2 - 1U) << 12);
+    canRegister(CanBrpeOffset) = (prescaler - 1U) >> 6;
+    cntl |= CanCntlTest;                        // The test register is writable only in the test mode
+    canRegister(CanTestOffset) = CanTestSilent;
+    canRegister(CanStatOffset) = CanStatLecNoChange;
+    cntl &= ~(CanCntlInit | CanCntlCce);
+
+    return true;
+}
+
+bool isCanBitRateConfirmed()
+{
+    // Unlike the message objects, RXOK is set regardless of the acceptance filters
+    return (canRegister(CanStatOffset) & CanStatRxOk) != 0;
+}
+
+void stopCanBitRateProbe()
+{
+    volatile std::uint32_t& cntl = canRegister(CanCntlOffset);
+    cntl |= CanCntlInit;
+    canRegister(CanTestOffset) = 0;
+    cntl &= ~CanCntlTest;
+}
+
+#if HARDPOINT_FAST_PATH
+void enableHardpointCommandFastPath(std::uint16_t data_type_id, std::uint8_t hardpoint_id)
+{
+    CriticalSectionLocker locker;
+    hardpoint_fast_path_data_type_id = data_type_id;
+    hardpoint_fast_path_hardpoint_id = hardpoint_id;
+    hardpoint_fast_path_enabled = true;
+}
+
+bool takeHardpointCommand(std::uint16_t& out_command)
+{
+    std::uint32_t mailbox = 0;
+    {
+        CriticalSectionLocker locker;
+        mailbox = hardpoint_command_mailbox;
+        hardpoint_command_mailbox = 0;
+    }
+
+    out_command = static_cast<std::uint16_t>(mailbox);
+    return (mailbox & HardpointCommandLatched) != 0;
+}
+#endif
+
 void resetWatchdog()
 {
     Chip_WWDT_Feed(LPC_WWDT);
@@ -340,9 +1014,16 @@ void setStatusLed(bool state)
     {
         gpio::makeOutputsAndSet(StatusLedPortNum, StatusLedPinMask, state ? StatusLedPinMask : 0);
     }
-    else
+    else if (gpio::markOutputs(StatusLedPortNum, StatusLedPinMask) != 0)
     {
+        /*
+         * The button may have been pressed while the pin was driven, so the press starts now. If it is not pressed,
+         * the pull-down makes a falling edge right away, which is too short to be counted.
+         */
+        CriticalSectionLocker locker;
         gpio::makeInputs(StatusLedPortNum, StatusLedPinMask);
+        button_pressed = true;
+        button_pressed_at_usec = LPC_TIMER32_0->TC;
     }
 }
 
@@ -354,6 +1035,51 @@ void setCanLed(bool state)
     gpio::set(CanLedPortNum, CanLedPinMask, state ? CanLedPinMask : 0);
 }
 
+#if PUMP_TIMER
+
+void startPump(std::uint_fast16_t iterations,
+               const std::uint_fast8_t delay_on,
+               const std::uint_fast8_t delay_off)
+{
+    static constexpr std::uint32_t IterationTicks   = nsToPumpTimerTicks(PumpIterationNs);
+    static constexpr std::uint32_t OnOverheadTicks  = nsToPumpTimerTicks(PumpOnOverheadNs);
+    static constexpr std::uint32_t OffOverheadTicks = nsToPumpTimerTicks(PumpOffOverheadNs);
+
+    // The switch on PIO1_0 is not driven, see build_config::NumDrivenPumpSwitches
+    const std::uint32_t on_ticks  = (delay_on * IterationTicks + OnOverheadTicks) *
+                                    build_config::NumDrivenPumpSwitches / build_config::NumPumpSwitches;
+    const std::uint32_t off_ticks = delay_off * IterationTicks + OffOverheadTicks;
+    const std::uint32_t period_ticks = on_ticks + off_ticks;
+
+    // The gate fires in the middle of the last period, giving the interrupt half a period of latency budget
+    const std::uint32_t gate_ticks = (std::uint32_t(iterations) - 1U) * period_ticks + period_ticks / 2U;
+    const std::uint32_t gate_prescaler = gate_ticks / 0x10000U;
+
+    LPC_TIMER32_1->TCR = TIMER_RESET;
+    LPC_TIMER32_1->MR[0] = off_ticks;                       // The outputs are set high on match
+    LPC_TIMER32_1->MR[1] = off_ticks;
+    LPC_TIMER32_1->MR[3] = off_ticks;
+    LPC_TIMER32_1->MR[PumpTimerPeriodMatch] = period_ticks - 1U;
+    LPC_TIMER32_1->MCR = TIMER_RESET_ON_MATCH(PumpTimerPeriodMatch);
+
+    LPC_TIMER16_1->TCR = TIMER_RESET;
+    LPC_TIMER16_1->PR = gate_prescaler;
+    LPC_TIMER16_1->MR[PumpGateMatch] = gate_ticks / (gate_prescaler + 1U);
+    LPC_TIMER16_1->IR = TIMER_IR_CLR(PumpGateMatch);
+
+    LPC_TIMER32_1->TCR = TIMER_ENABLE;
+    LPC_TIMER16_1->TCR = TIMER_ENABLE;
+}
+
+bool isPumpRunning()
+{
+    return (LPC_TIMER32_1->TCR & TIMER_ENABLE) != 0;
+}
+
+#else
+
+namespace
+{
 /*
  * Note: Moving the code to RAM makes it run faster, but it prevents the compiler from inlining it,
  *       which adds the function call overhead.
@@ -365,9 +1091,14 @@ void runPump(std::uint_fast16_t iterations,
 {
     /*
      * Ton (ns)  = (delay_on  * 5 + 2)  * 20.8
-     * Toff (ns) = (delay_off * 5 + 12) * 20.8
+     * Toff (ns) = (delay_off * 5 + 16) * 20.8
+     *
+     * These numbers are mirrored by PumpIterationNs, PumpOnOverheadNs and PumpOffOverheadNs in board.hpp.
+     * The build fails if they do not match the generated code, see tools/check_pump_timing.py.
      *
      * Note that the following code has been carefully optimized for speed and determinism.
+     * The listing predates the pump stop check, which adds a load and a test of pump_stop_voltage_reached
+     * to the outer loop.
      *
      * 100000c0:   movs r0, #50    ; 0x32
      * 100000c2:   push {r4, lr}
@@ -421,9 +1152,25 @@ void runPump(std::uint_fast16_t iterations,
         }
         while (--ioff);
     }
-    while (--iterations);
+    while (--iterations && !pump_stop_voltage_reached);
+}
+
+}
+
+void startPump(std::uint_fast16_t iterations,
+               const std::uint_fast8_t delay_on,
+               const std::uint_fast8_t delay_off)
+{
+    runPump(iterations, delay_on, delay_off);
+}
+
+bool isPumpRunning()
+{
+    return false;
 }
 
+#endif
+
 void setMagnetPos()
 {
     gpio::set(MagnetCtrlPortNum, MagnetCtrlPinMask23, MagnetCtrlPinMask23);
@@ -445,49 +1192,26 @@ std::uint8_t readDipSwitch()
 
 bool hadButtonPressEvent()
 {
-    constexpr std::uint8_t PressCounterThreshold = 200;
-    static std::uint8_t press_counter = 0;
-
-    if (gpio::markOutputs(StatusLedPortNum, StatusLedPinMask) != 0)
-    {
-        return false;   // Press counter is not reset
-    }
-
-    if (gpio::get(StatusLedPortNum, StatusLedPinMask) != 0)
-    {
-        press_counter = std::min(static_cast<std::uint8_t>(press_counter + 1), PressCounterThreshold);
-        return false;
-    }
-    else
+    CriticalSectionLocker locker;
+    if (button_press_events > 0)
     {
-        const bool had_press = press_counter >= PressCounterThreshold;
-        press_counter = 0;
-        return had_press;
+        button_press_events--;
+        return true;
     }
+    return false;
 }
 
 unsigned getSupplyVoltageInMillivolts()     //error under 2%
 {
-    static std::uint16_t old_value = 0;
-
-    std::uint16_t new_value = 0;
-    (void)Chip_ADC_ReadValue(LPC_ADC, ADC_CH6, &new_value);
-
-    // Division and multiplication by 2 are reduced
-    unsigned x = static_cast<unsigned>((static_cast<unsigned>(new_value + old_value) * AdcReferenceMillivolts) >>
-                                       AdcResolutionBits);
-
-    if (old_value == 0)  // If old value is uninitialized, the result will be half of the real value
-    {
-        x *= 2;
-    }
+    resumeAdc();
 
-    old_value = new_value;
+    // Multiplication by 2 is reduced, the sum of the filter is scaled to the sum of two samples
+    unsigned x = static_cast<unsigned>((adc_supply_sum * AdcReferenceMillivolts) >>
+                                       (AdcResolutionBits + AdcFilterLengthLog2 - 1U));
 
-    x *= 556;
-    x = x / 100;                        // should be /= but does not work
+    x = (x * SupplyDividerRatioQ16) >> 16;                  // Was x * 556 / 100, same result or 1 mV less
 
-    x = std::max(4300U, x);             // This is because measurements below this voltage are highly unreliable
+    x = std::max(SupplyVoltageMinMillivolts, x);
 
 #if BOARD_OLIMEX_LPC_P11C24
     x = 5000;                           // Simulation...
@@ -497,14 +1221,31 @@ unsigned getSupplyVoltageInMillivolts()     //error under 2%
 
 unsigned getOutVoltageInVolts()
 {
-    std::uint16_t result = 0;
-    (void)Chip_ADC_ReadValue(LPC_ADC, ADC_CH0, &result);
-    // Division and multiplication by 2 are reduced
-    const unsigned x =
-        static_cast<unsigned>((static_cast<unsigned>(result) * AdcReferenceMillivolts) >>
-                              AdcResolutionBits);
+    resumeAdc();
+
+    // Division and multiplication by 2 are reduced, division by 5 is folded into the reference
+    return static_cast<unsigned>((adc_output_sum * (AdcReferenceMillivolts / 5U)) >>
+                                 (AdcResolutionBits + AdcFilterLengthLog2));
+}
+
+std::uint32_t getAdcScanCount()
+{
+    return adc_scan_count;
+}
+
+void setPumpStopVoltage(unsigned volts)
+{
+    resumeAdc();
+
+    pump_stop_voltage = volts;
+    pump_stop_voltage_reached = false;      // Until the next scan, the last one was compared against the old value
+}
+
+bool isPumpStopVoltageReached()
+{
+    resumeAdc();
 
-    return x / 5;
+    return pump_stop_voltage_reached;
 }
 
 #if __GNUC__
@@ -512,27 +1253,29 @@ __attribute__((optimize(1)))    // Fails
 #endif
 PwmInput getPwmInput()
 {
-    if ((uavcan_lpc11c24::clock::getMonotonic() - last_pwm_input_update_ts).toUSec() > PwmInputTimeoutUSec)
+    // Once cleared, the value stays invalid until the next pulse, so the wraparound of the timer is harmless
+    if ((LPC_TIMER32_0->TC - last_pwm_input_update_usec) > PwmInputTimeoutUSec)
     {
         pwm_input_pulse_usec = 0;
     }
 
-    if (pwm_input_pulse_usec == 0)
-    {
-        return PwmInput::NoSignal;
-    }
-    else if (pwm_input_pulse_usec < 1250)
-    {
-        return PwmInput::Low;
-    }
-    else if (pwm_input_pulse_usec > 1750)
-    {
-        return PwmInput::High;
-    }
-    else
+    return classifyPwmPulse(pwm_input_pulse_usec);
+}
+
+void sleepUntilInterrupt()
+{
+    // The ADC interrupt would wake the core on every scan
+    if (!adc_paused)
     {
-        return PwmInput::Neutral;
+        NVIC_DisableIRQ(ADC_IRQn);
+        adc_paused = true;
     }
+
+    LPC_TIMER32_0->MR[IdleWakeupMatch] = LPC_TIMER32_0->TC + IdleWakeupPeriodUSec;
+    LPC_TIMER32_0->IR = TIMER_IR_CLR(IdleWakeupMatch);
+    LPC_TIMER32_0->MCR = TIMER_INT_ON_MATCH(IdleWakeupMatch);
+
+    __WFI();
 }
 
 void delayUSec(std::uint8_t usec)
@@ -558,6 +1301,8 @@ void delayUSec(std::uint8_t usec)
 
 void delayMSec(unsigned msec)
 {
+    profiler::ScopedSection section(profiler::Section::Delay);
+
     while (msec --> 0)
     {
         for (std::uint8_t i = 0; i < 4; i++)
@@ -569,7 +1314,14 @@ void delayMSec(unsigned msec)
 
 void syslog(const char* msg)
 {
-    Chip_UART_SendBlocking(LPC_USART, msg, static_cast<int>(std::strlen(msg)));
+    profiler::ScopedSection section(profiler::Section::Syslog);
+
+#if TOKENIZED_SYSLOG
+    sendSyslogRecord(SyslogTextToken, reinterpret_cast<const std::uint8_t*>(msg),
+                     static_cast<unsigned>(std::strlen(msg)));
+#else
+    enqueueSyslog(msg, static_cast<unsigned>(std::strlen(msg)));
+#endif
 }
 
 void syslog(const char* prefix, long long integer_value, const char* suffix)
@@ -607,6 +1359,42 @@ void syslog(const char* prefix, long long integer_value, const char* suffix)
     syslog(suffix);
 }
 
+std::uint32_t getSyslogDroppedMessages()
+{
+    return syslog_dropped_messages;
+}
+
+#if TOKENIZED_SYSLOG
+
+void syslogToken(const char* entry)
+{
+    profiler::ScopedSection section(profiler::Section::Syslog);
+
+    sendSyslogRecord(static_cast<std::uint16_t>(reinterpret_cast<std::uintptr_t>(entry)), nullptr, 0);
+}
+
+void syslogToken(const char* entry, long long integer_value)
+{
+    profiler::ScopedSection section(profiler::Section::Syslog);
+
+    // Zigzag, so that small negative values are short too
+    std::uint64_t x = (static_cast<std::uint64_t>(integer_value) << 1) ^
+                      static_cast<std::uint64_t>(integer_value >> 63);
+
+    std::uint8_t varint[10];
+    unsigned len = 0;
+    while (x >= 0x80U)
+    {
+        varint[len++] = static_cast<std::uint8_t>(x | 0x80U);
+        x >>= 7;
+    }
+    varint[len++] = static_cast<std::uint8_t>(x);
+
+    sendSyslogRecord(static_cast<std::uint16_t>(reinterpret_cast<std::uintptr_t>(entry)), &varint[0], len);
+}
+
+#endif
+
 } // namespace board
 
 extern "C"
@@ -617,42 +1405,146 @@ void PIOINT2_IRQHandler()
 {
     using namespace board;
 
+    // Read first, so that the timestamp does not depend on the code below
+    const std::uint32_t ts_usec = LPC_TIMER32_0->TC;
+
     if ((LPC_GPIO[PwmPortNum].MIS & PwmInputPinMask) != 0)
     {
         // This is a work-around for a hardware bug, see above
-        LPC_GPIO[PwmPortNum].IBE = PwmInputPinMask;
+        LPC_GPIO[PwmPortNum].IBE |= PwmInputPinMask;
         LPC_GPIO[PwmPortNum].IC = PwmInputPinMask;
 
-        static uavcan::MonotonicTime prev_ts;
-        const auto ts = uavcan_lpc11c24::clock::getMonotonic();         // TODO: Is it safe to call it from here?
-        const auto diff_usec = static_cast<std::uint64_t>((ts - prev_ts).toUSec());
-        prev_ts = ts;
+        static std::uint32_t prev_ts_usec;
+        const std::uint32_t diff_usec = ts_usec - prev_ts_usec;
+        prev_ts_usec = ts_usec;
 
         const bool input_state = (LPC_GPIO[PwmPortNum].DATA[PwmInputPinMask] & PwmInputPinMask) != 0;
 
         if (!input_state)       // Updating only on trailing edge
         {
-            last_pwm_input_update_ts = ts;
+            last_pwm_input_update_usec = ts_usec;
 
-            if (diff_usec >= PwmInputPeriodMinUSec && diff_usec <= PwmInputPeriodMaxUSec)
+            const bool valid = (diff_usec >= PwmInputPeriodMinUSec) && (diff_usec <= PwmInputPeriodMaxUSec);
+            const std::uint32_t pulse_usec = valid ? diff_usec : 0;
+
+            // A single glitch breaks the series, so it never changes the input state
+            static PwmInput prev_class;
+            static std::uint8_t num_consistent_pulses;
+            const PwmInput pulse_class = classifyPwmPulse(pulse_usec);
+            if (pulse_class != prev_class)
             {
-                if (pwm_input_pulse_usec == 0)
-                {
-                    pwm_input_pulse_usec = static_cast<std::uint32_t>(diff_usec);
-                }
-                else
-                {
-                    pwm_input_pulse_usec = static_cast<std::uint32_t>((pwm_input_pulse_usec + diff_usec) / 2);
-                }
+                num_consistent_pulses = 1;
+            }
+            else if (num_consistent_pulses < PwmInputMinConsistentPulses)
+            {
+                num_consistent_pulses++;
+            }
+            prev_class = pulse_class;
+            if (num_consistent_pulses >= PwmInputMinConsistentPulses)
+            {
+                pwm_input_pulse_usec = pulse_usec;
+            }
+        }
+    }
+
+    if ((LPC_GPIO[StatusLedPortNum].MIS & StatusLedPinMask) != 0)
+    {
+        LPC_GPIO[StatusLedPortNum].IBE |= StatusLedPinMask;       // Same work-around as above
+        LPC_GPIO[StatusLedPortNum].IC = StatusLedPinMask;
+
+        // The edges made by the LED itself are ignored
+        if (gpio::markOutputs(StatusLedPortNum, StatusLedPinMask) == 0)
+        {
+            if (gpio::get(StatusLedPortNum, StatusLedPinMask) != 0)
+            {
+                button_pressed = true;
+                button_pressed_at_usec = ts_usec;
             }
             else
             {
-                pwm_input_pulse_usec = 0;      // Invalid value
+                if (button_pressed && ((ts_usec - button_pressed_at_usec) >= ButtonMinPressUSec) &&
+                    (button_press_events < 0xFFU))
+                {
+                    button_press_events++;
+                }
+                button_pressed = false;
             }
         }
     }
 }
 
+void ADC_IRQHandler();
+void ADC_IRQHandler()
+{
+    const board::AdcScan scan = board::readAdcScan();
+
+    board::AdcScan& oldest = board::adc_scans[board::adc_oldest_scan_index];
+    board::adc_supply_sum = board::adc_supply_sum - oldest.supply + scan.supply;
+    board::adc_output_sum = board::adc_output_sum - oldest.output + scan.output;
+    oldest = scan;
+    board::adc_oldest_scan_index = (board::adc_oldest_scan_index + 1U) & (board::AdcFilterLength - 1U);
+    board::adc_scan_count++;
+
+    // Same arithmetic as getOutVoltageInVolts(), for a single scan
+    const unsigned output_voltage = (scan.output * (board::AdcReferenceMillivolts / 5U)) >> board::AdcResolutionBits;
+    const unsigned stop_voltage = board::pump_stop_voltage;
+    board::pump_stop_voltage_reached = (stop_voltage > 0) && (output_voltage >= stop_voltage);
+
+#if PUMP_TIMER
+    if (board::pump_stop_voltage_reached)
+    {
+        // The burst ends when the current period is over, like in TIMER16_1_IRQHandler()
+        LPC_TIMER32_1->MCR = TIMER_RESET_ON_MATCH(board::PumpTimerPeriodMatch) |
+                             TIMER_STOP_ON_MATCH(board::PumpTimerPeriodMatch);
+    }
+#endif
+}
+
+void UART_IRQHandler();
+void UART_IRQHandler()
+{
+    // The receiver is not used, so only the transmit part of Chip_UART_IRQRBHandler() is needed
+    Chip_UART_TXIntHandlerRB(LPC_USART, &board::syslog_buffer);
+
+    if (RingBuffer_IsEmpty(&board::syslog_buffer))
+    {
+        Chip_UART_IntDisable(LPC_USART, UART_IER_THREINT);
+    }
+}
+
+#if PUMP_TIMER
+void TIMER16_1_IRQHandler();
+void TIMER16_1_IRQHandler()
+{
+    // The burst ends when the current period is over, the outputs are left low
+    LPC_TIMER32_1->MCR = TIMER_RESET_ON_MATCH(board::PumpTimerPeriodMatch) |
+                         TIMER_STOP_ON_MATCH(board::PumpTimerPeriodMatch);
+    LPC_TIMER16_1->IR = TIMER_IR_CLR(board::PumpGateMatch);
+}
+#endif
+
+#if HARDPOINT_FAST_PATH
+void CAN_IRQHandler();                  // Defined by the driver
+
+/**
+ * Installed into the vector table instead of the handler of the driver, see crt0.c.
+ */
+void CAN_FastPath_IRQHandler();
+void CAN_FastPath_IRQHandler()
+{
+    board::latchHardpointCommand();
+    CAN_IRQHandler();
+}
+#endif
+
+void TIMER32_0_IRQHandler();
+void TIMER32_0_IRQHandler()
+{
+    // Single shot, the counter keeps running since it timestamps the pin interrupt
+    LPC_TIMER32_0->MCR = 0;
+    LPC_TIMER32_0->IR = TIMER_IR_CLR(board::IdleWakeupMatch);
+}
+
 void Chip_SYSCTL_PowerUp(std::uint32_t powerupmask)
 {
     board::sysctlPowerUp(powerupmask);
@@ -30,6 +30,21 @@
 # define BOARD_OLIMEX_LPC_P11C24 0
 #endif
 
+/// Pump switching by the hardware timer instead of the busy loop, see startPump()
+#ifndef PUMP_TIMER
+# define PUMP_TIMER 0
+#endif
+
+/// Binary tokenized syslog records instead of the text, see BOARD_SYSLOG()
+#ifndef TOKENIZED_SYSLOG
+# define TOKENIZED_SYSLOG 0
+#endif
+
+/// Hardpoint commands decoded in the CAN interrupt, see takeHardpointCommand()
+#ifndef HARDPOINT_FAST_PATH
+# define HARDPOINT_FAST_PATH 0
+#endif
+
 namespace board
 {
 
@@ -48,14 +63,105 @@ __attribute__((noreturn))
 #endif
 void die();
 
+/**
+ * Resets the MCU, e.g. to boot again with another persistent config.
+ */
+#if __GNUC__
+__attribute__((noreturn))
+#endif
+void restart();
+
 typedef std::array<std::uint8_t, 16> UniqueID;
 void readUniqueID(UniqueID& out_uid);
 
 typedef std::array<std::uint8_t, 128> DeviceSignature;
 bool tryReadDeviceSignature(DeviceSignature& out_signature);
 
+/**
+ * Configuration kept in the flash across power cycles, so that the next boot can skip the bit rate detection and
+ * the dynamic node ID allocation. Zero means unknown.
+ * The application parameters are opaque here; only the first num_params of them are valid.
+ */
+struct PersistentConfig
+{
+    static constexpr unsigned MaxParams = 8;
+
+    std::uint32_t can_bit_rate = 0;
+    std::uint8_t node_id = 0;
+    std::uint8_t num_params = 0;
+    std::array<std::uint32_t, MaxParams> params{};
+
+    bool operator==(const PersistentConfig& rhs) const
+    {
+        return (can_bit_rate == rhs.can_bit_rate) && (node_id == rhs.node_id) && (num_params == rhs.num_params) &&
+               (params == rhs.params);
+    }
+};
+
+/**
+ * Returns false if nothing has been stored yet.
+ */
+bool tryReadPersistentConfig(PersistentConfig& out_config);
+
+/**
+ * Stores the config, unless it is already stored. Each write takes a new 256-byte page of the last flash sector,
+ * below the device signature; once all 15 pages are used, the sector is erased, the signature is programmed back,
+ * and the writes start over. The interrupts are disabled for about a millisecond while programming, or about 100 ms
+ * if the sector is erased. If the write fails, the previously stored config stays in effect. A power loss during the
+ * erase loses the stored config, so the next boot falls back to the bit rate detection, the node ID allocation and
+ * the default parameters, and, until the signature is programmed back, the signature too.
+ */
+bool writePersistentConfig(const PersistentConfig& config);
+
+/**
+ * Makes the CAN controller listen at the bit rate in the silent mode, where it receives the frames, but neither
+ * acknowledges them nor signals errors, so that a bit rate can be tried without disturbing the bus. The silent mode
+ * is set up before the controller leaves the initialization state. Must be called before the CAN driver is
+ * initialized; returns false if the bit rate cannot be set up.
+ */
+bool startCanBitRateProbe(std::uint32_t bit_rate);
+
+/**
+ * Returns true once a frame has been received without errors since the probe was started.
+ */
+bool isCanBitRateConfirmed();
+
+/**
+ * Puts the CAN controller back into the initialization state, ready for the driver.
+ */
+void stopCanBitRateProbe();
+
+#if HARDPOINT_FAST_PATH
+/**
+ * Makes the CAN interrupt decode the single frame transfers of the hardpoint command message, before the driver
+ * queues them for libuavcan, and latch the command if the first byte (the hardpoint ID) matches. libuavcan still
+ * receives the frames as usual. Must be called after the acceptance filters are configured.
+ */
+void enableHardpointCommandFastPath(std::uint16_t data_type_id, std::uint8_t hardpoint_id);
+
+/**
+ * Returns the last command latched by the CAN interrupt since the previous call, if any.
+ * This is best effort: a frame that the interrupt did not see is still delivered by libuavcan.
+ */
+bool takeHardpointCommand(std::uint16_t& out_command);
+#endif
+
 void resetWatchdog();
 
+/**
+ * Stops the core (WFI) until the next interrupt: CAN, the PWM input or the button, the syslog UART, or the wake-up
+ * timer, which limits the sleep to IdleWakeupPeriodUSec so that the main loop still runs at 1 kHz.
+ * The clocks are not changed, since the CAN bit timing, the UART baud rate, the ADC and the timers, including
+ * the uavcan clock, are all derived from the 48 MHz PLL output, and the node must keep receiving while idle.
+ *
+ * The ADC interrupt, which would otherwise wake the core on every scan, stays paused after the sleep. The next
+ * voltage reading or setPumpStopVoltage() resumes it and takes the latest scan, which is never older than one scan
+ * period, as the new content of the filter, so the readings are fresh without waiting for the filter to refill.
+ */
+static constexpr unsigned IdleWakeupPeriodUSec = 1000;
+
+void sleepUntilInterrupt();
+
 void setStatusLed(bool state);
 void setCanLed(bool state);
 
@@ -63,11 +169,43 @@ void setCanLed(bool state);
  * Switches the pump specified number of times with specified duty cycle.
  * Warning: this function does not check correctness of the arguments.
  * All arguments MUST BE POSITIVE.
+ *
+ * By default, the pump is switched by a busy loop with interrupts disabled during the on phase, and the function
+ * returns when the switching is finished. If PUMP_TIMER is set, the switching is performed by a hardware timer
+ * in the background and the function returns immediately; use isPumpRunning() to check for completion.
+ *
+ * The switch on and off durations are:
+ *   Ton  = delay_on  * PumpIterationNs + PumpOnOverheadNs
+ *   Toff = delay_off * PumpIterationNs + PumpOffOverheadNs
+ * These constants depend on the machine code generated for the busy loop, they are checked against the
+ * disassembly of the firmware at build time by tools/check_pump_timing.py. The timer reproduces them.
  */
-__attribute__((noinline, long_call, section(".data")))
-void runPump(std::uint_fast16_t iterations,
-             std::uint_fast8_t delay_on,
-             std::uint_fast8_t delay_off);
+static constexpr unsigned PumpIterationNs   = 104;
+static constexpr unsigned PumpOnOverheadNs  = 42;
+static constexpr unsigned PumpOffOverheadNs = 333;
+
+void startPump(std::uint_fast16_t iterations,
+               std::uint_fast8_t delay_on,
+               std::uint_fast8_t delay_off);
+
+/**
+ * Whether the switching started by startPump() is still in progress. Always false without PUMP_TIMER.
+ */
+bool isPumpRunning();
+
+/**
+ * Sets the output voltage at which the running pump burst is stopped, zero disables the stop.
+ * Each ADC scan compares the output voltage against it in the interrupt, and the burst is stopped at the end of
+ * the current switching period once it is reached, so the burst does not overshoot the target by more than one
+ * scan interval. Without PUMP_TIMER the interrupt is held off during the on phase, the check is the same.
+ */
+void setPumpStopVoltage(unsigned volts);
+
+/**
+ * Whether the last ADC scan has seen the output voltage at or above the stop voltage.
+ * Unlike getOutVoltageInVolts(), this is not filtered, so it reacts to the end of a burst immediately.
+ */
+bool isPumpStopVoltageReached();
 
 void setMagnetPos();
 void setMagnetNeg();
@@ -77,14 +215,31 @@ std::uint8_t readDipSwitch();
 
 /**
  * Whether the button was pressed since last invokation of this function.
- * This function must be called at least every 10 ms.
+ * The presses are detected by the pin interrupt and queued, so they are not lost if the function is called late.
  */
 bool hadButtonPressEvent();
 
+/**
+ * Both voltages are sampled by the ADC in the background at AdcScansPerSecond, the readings are the running
+ * average of the last 8 scans (0.8 ms). The readings are O(1); the first one after sleepUntilInterrupt() is the
+ * latest single scan.
+ */
+static constexpr unsigned AdcScansPerSecond = 10000;
+
+/**
+ * The supply voltage readings are clamped to this minimum, since the measurements below it are highly unreliable.
+ */
+static constexpr unsigned SupplyVoltageMinMillivolts = 4300;
+
 unsigned getSupplyVoltageInMillivolts();
 
 unsigned getOutVoltageInVolts();
 
+/**
+ * Number of ADC scans since boot, i.e. the timestamp of the readings above.
+ */
+std::uint32_t getAdcScanCount();
+
 /**
  * Status of the PWM input.
  */
@@ -96,6 +251,12 @@ enum class PwmInput : std::uint8_t
     High
 };
 
+/**
+ * Classifies the PWM input: pulses shorter than 1250 us are Low, longer than 1750 us are High. Two pulses in a row
+ * must agree before the state changes, so that a single glitch does not switch the magnet. The edges are timestamped
+ * by a hardware timer with microsecond resolution; the timestamp is still delayed by the interrupt latency,
+ * including the windows where the interrupts are disabled, see startPump().
+ */
 PwmInput getPwmInput();
 
 /**
@@ -114,9 +275,56 @@ void delayMSec(unsigned msec);
 
 /**
  * Prints the message to the debug serial.
- * Transmission in blocking.
+ * The message is queued into a ring buffer that is transmitted by the UART interrupt, so the call does not wait
+ * for the transmission. A message that does not fit in the free space is dropped as a whole and counted,
+ * see getSyslogDroppedMessages(). The buffer fits the report of the loop profiler, the longest burst of messages.
  */
+static constexpr unsigned SyslogBufferSize = 512;       ///< Must be a power of 2, see ring_buffer.h
+
 void syslog(const char* msg);
 void syslog(const char* prefix, long long integer_value, const char* suffix = "");
 
+/**
+ * Number of messages dropped since boot because the syslog buffer was full.
+ */
+std::uint32_t getSyslogDroppedMessages();
+
+#if TOKENIZED_SYSLOG
+/**
+ * Sends the binary record of a message logged by BOARD_SYSLOG(). The entry is only used as the token,
+ * it is never dereferenced on the target since the dictionary is not loaded.
+ */
+void syslogToken(const char* entry);
+void syslogToken(const char* entry, long long integer_value);
+#endif
+
 }
+
+/**
+ * Logs a message whose text is known at compile time, the strings must be literals:
+ *   BOARD_SYSLOG(msg)
+ *   BOARD_SYSLOG(prefix, integer_value[, suffix])
+ *
+ * With TOKENIZED_SYSLOG, the text is not stored in the flash. It is placed into the .syslog_dict section, which is
+ * kept in the ELF but not loaded, and the call sends a short binary record with the offset of the text in the
+ * section and the integer value; tools/syslog_decode.py rebuilds the text using the ELF.
+ * Otherwise the macro is the same as board::syslog().
+ */
+#if TOKENIZED_SYSLOG
+# define BOARD_SYSLOG_ENTRY(text)                                                       \
+    ([]() -> const char*                                                                \
+    {                                                                                   \
+        __attribute__((section(".syslog_dict"), used)) static const char s[] = text;    \
+        return &s[0];                                                                   \
+    }())
+# define BOARD_SYSLOG1(msg)                   ::board::syslogToken(BOARD_SYSLOG_ENTRY(msg))
+# define BOARD_SYSLOG2(prefix, value)         ::board::syslogToken(BOARD_SYSLOG_ENTRY(prefix "%d"), (value))
+# define BOARD_SYSLOG3(prefix, value, suffix) ::board::syslogToken(BOARD_SYSLOG_ENTRY(prefix "%d" suffix), (value))
+#else
+# define BOARD_SYSLOG1(msg)                   ::board::syslog(msg)
+# define BOARD_SYSLOG2(prefix, value)         ::board::syslog(prefix, (value))
+# define BOARD_SYSLOG3(prefix, value, suffix) ::board::syslog(prefix, (value), suffix)
+#endif
+
+#define BOARD_SYSLOG_SELECT(_1, _2, _3, name, ...) name
+#define BOARD_SYSLOG(...) BOARD_SYSLOG_SELECT(__VA_ARGS__, BOARD_SYSLOG3, BOARD_SYSLOG2, BOARD_SYSLOG1, _)(__VA_ARGS__)
@@ -154,6 +154,16 @@ void PIOINT1_IRQHandler(void) ALIAS(Default_Handler);
 void PIOINT0_IRQHandler(void) ALIAS(Default_Handler);
 void WAKEUP_IRQHandler(void) ALIAS(Default_Handler);
 
+#if defined(HARDPOINT_FAST_PATH) && HARDPOINT_FAST_PATH
+/**
+ * Decodes the hardpoint commands before calling CAN_IRQHandler() of the driver, see board.cpp
+ */
+void CAN_FastPath_IRQHandler(void);
+# define CAN_VECTOR CAN_FastPath_IRQHandler
+#else
+# define CAN_VECTOR CAN_IRQHandler
+#endif
+
 /**
  * Refer to the linker script
  */
@@ -197,7 +207,7 @@ void (* const VectorTable[64])(void) =
     WAKEUP_IRQHandler,                      // PIO0_11 Wakeup
     WAKEUP_IRQHandler,                      // PIO1_0  Wakeup
 
-    CAN_IRQHandler,                         // C_CAN Interrupt
+    CAN_VECTOR,                             // C_CAN Interrupt
     SSP1_IRQHandler,                        // SPI/SSP1 Interrupt
     I2C_IRQHandler,                         // I2C0
     TIMER16_0_IRQHandler,                   // CT16B0 (16-bit Timer 0)
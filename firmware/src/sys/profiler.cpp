@@ -0,0 +1,143 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.hpp"
+
+#if LOOP_PROFILER
+
+#include "board.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace profiler
+{
+namespace
+{
+
+static constexpr std::uint32_t ReportIntervalUSec = 10000000;
+
+const char* const SectionNames[unsigned(Section::NumSections)] =
+{
+    "spin   ",
+    "poll   ",
+    "magnet ",
+    "syslog ",
+    "delay  ",
+    "sleep  "
+};
+
+struct Stats
+{
+    std::uint32_t count = 0;
+    std::uint32_t total_usec = 0;
+    std::uint32_t min_usec = std::numeric_limits<std::uint32_t>::max();
+    std::uint32_t max_usec = 0;
+
+    void add(std::uint32_t usec)
+    {
+        count++;
+        total_usec += usec;
+        min_usec = std::min(min_usec, usec);
+        max_usec = std::max(max_usec, usec);
+    }
+
+    std::uint32_t getAverage() const { return (count > 0) ? (total_usec / count) : 0; }
+};
+
+Stats loop_period;
+Stats sections[unsigned(Section::NumSections)];
+
+std::uint32_t window_started_at;
+std::uint32_t last_iteration_at;
+bool started = false;
+bool reporting = false;
+
+/**
+ * Wraps around every 71 minutes, which is harmless since only differences are used.
+ */
+std::uint32_t getTimeUSec()
+{
+    return static_cast<std::uint32_t>(board::clock::getMonotonic().toUSec());
+}
+
+void printReport(std::uint32_t window_usec)
+{
+    BOARD_SYSLOG("\r\nLoop n=", loop_period.count);
+    BOARD_SYSLOG(" min=", loop_period.min_usec);
+    BOARD_SYSLOG(" avg=", loop_period.getAverage());
+    BOARD_SYSLOG(" max=", loop_period.max_usec, " us");
+    BOARD_SYSLOG(" syslog dropped=", board::getSyslogDroppedMessages(), "\r\n");
+
+    for (unsigned i = 0; i < unsigned(Section::NumSections); i++)
+    {
+        const auto& s = sections[i];
+        board::syslog(SectionNames[i]);
+        BOARD_SYSLOG("n=", s.count);
+        BOARD_SYSLOG(" avg=", s.getAverage());
+        BOARD_SYSLOG(" max=", s.max_usec);
+        BOARD_SYSLOG(" us load=", s.total_usec / std::max<std::uint32_t>(window_usec / 1000U, 1U), " permille\r\n");
+    }
+}
+
+}
+
+void markLoopIteration()
+{
+    const auto ts = getTimeUSec();
+
+    if (started)
+    {
+        loop_period.add(ts - last_iteration_at);
+    }
+    else
+    {
+        started = true;
+        window_started_at = ts;
+    }
+
+    last_iteration_at = ts;
+
+    if ((ts - window_started_at) >= ReportIntervalUSec)
+    {
+        reporting = true;
+        printReport(ts - window_started_at);
+        reporting = false;
+
+        // The time spent printing the report is not accounted
+        loop_period = Stats();
+        std::fill(std::begin(sections), std::end(sections), Stats());
+        window_started_at = last_iteration_at = getTimeUSec();
+    }
+}
+
+std::uint32_t beginSection()
+{
+    return getTimeUSec();
+}
+
+void endSection(Section section, std::uint32_t started_at)
+{
+    if (!reporting)
+    {
+        sections[unsigned(section)].add(getTimeUSec() - started_at);
+    }
+}
+
+}
+
+#endif
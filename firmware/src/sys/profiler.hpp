@@ -0,0 +1,85 @@
+/*
+ * OpenGrab EPM - Electropermanent Magnet
+ * Copyright (C) 2016  Zubax Robotics <info@zubax.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Main loop profiler.
+ * Collects the period of the main loop and the time spent in the main sections of the firmware, based on the
+ * monotonic clock (SysTick). The statistics are printed to the debug serial every few seconds.
+ * Enabled with LOOP_PROFILER=1 at build time; otherwise all functions are empty and the profiler costs nothing.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#ifndef LOOP_PROFILER
+# define LOOP_PROFILER 0
+#endif
+
+namespace profiler
+{
+
+enum class Section : std::uint8_t
+{
+    Spin,           ///< Node::spinOnce()
+    Poll,           ///< callPollAndResetWatchdog(), includes magnet::poll()
+    Magnet,         ///< magnet::poll()
+    Syslog,         ///< A single board::syslog() call
+    Delay,          ///< board::delayMSec()
+    Sleep,          ///< board::sleepUntilInterrupt(), the load is the share of time the core is stopped
+    NumSections
+};
+
+#if LOOP_PROFILER
+
+/**
+ * Must be invoked once at the beginning of every main loop iteration.
+ * Prints the statistics and starts a new measurement window when the report interval has expired.
+ */
+void markLoopIteration();
+
+std::uint32_t beginSection();
+void endSection(Section section, std::uint32_t started_at);
+
+#else
+
+inline void markLoopIteration() { }
+
+#endif
+
+/**
+ * Measures the time from construction to destruction as the specified section.
+ */
+class ScopedSection
+{
+#if LOOP_PROFILER
+    const Section section_;
+    const std::uint32_t started_at_;
+
+public:
+    explicit ScopedSection(Section section) :
+        section_(section),
+        started_at_(beginSection())
+    { }
+
+    ~ScopedSection() { endSection(section_, started_at_); }
+#else
+public:
+    explicit ScopedSection(Section) { }
+#endif
+};
+
+}
@@ -0,0 +1,222 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2016 Zubax Robotics, zubax.com
+#
+# Computes the switching timing of board::runPump() from the disassembly of the firmware and checks it against
+# the constants that the charger relies on (PumpIterationNs, PumpOnOverheadNs, PumpOffOverheadNs in
+# src/sys/board.hpp). Exits with a non-zero status if they disagree.
+#
+# The expected structure of the function is:
+#     <on store>  <on delay loop>  <off store>  <off delay loop>  <outer loop branch>
+# where the on/off stores are the writes to the GPIO data register that turn the pump switches on and off.
+# Ton is counted from the completion of the on store to the completion of the off store, Toff from the
+# completion of the off store to the completion of the next on store.
+#
+
+from __future__ import print_function, division
+import argparse
+import re
+import subprocess
+import sys
+
+CPU_CLOCK_HZ = 48000000
+
+# Cortex-M0 instruction timings, ARM DDI 0432C table 3-1, zero wait state memory (the function runs from RAM)
+ONE_CYCLE = set('''
+adc adcs add adds adr and ands asr asrs bic bics cmn cmp cpsid cpsie eor eors lsl lsls lsr lsrs mov movs mul muls
+mvn mvns neg negs nop orr orrs ror rors rsb rsbs sbc sbcs sub subs sxtb sxth tst uxtb uxth rev rev16 revsh
+'''.split())
+TWO_CYCLES = set('ldr ldrb ldrh ldrsb ldrsh str strb strh'.split())
+CONDITIONS = 'eq ne cs hs cc lo mi pl vs vc hi ls ge lt gt le'.split()
+
+INSTRUCTION_RE = re.compile(r'^\s*([0-9a-f]+):\s+([a-z][a-z0-9.]*)\s*(.*)$')
+FUNCTION_RE = re.compile(r'^([0-9a-f]+) <(_ZN5board.*7runPump.*)>:$')
+RUN_PUMP_SECTION = '.data'
+
+
+class Instruction(object):
+    def __init__(self, address, mnemonic, operands):
+        self.address = address
+        self.mnemonic = mnemonic.split('.')[0]      # Drop width qualifiers: bne.n -> bne
+        self.operands = operands.split(';')[0].strip()
+
+    @property
+    def is_branch(self):
+        return self.mnemonic in ('b', 'bl', 'blx', 'bx') or self.is_conditional_branch
+
+    @property
+    def is_conditional_branch(self):
+        return self.mnemonic[0] == 'b' and self.mnemonic[1:] in CONDITIONS
+
+    @property
+    def branch_target(self):
+        return int(self.operands.split()[0], 16)
+
+    @property
+    def is_return(self):
+        return (self.mnemonic == 'pop' and 'pc' in self.operands) or (self.mnemonic == 'bx' and self.operands == 'lr')
+
+    @property
+    def is_store(self):
+        return self.mnemonic in ('str', 'strb', 'strh')
+
+    def cycles(self, branch_taken=True):
+        m = self.mnemonic
+        if m in ONE_CYCLE:
+            return 1
+        if m in TWO_CYCLES:
+            return 2
+        if self.is_conditional_branch:
+            return 3 if branch_taken else 1
+        if m == 'b':
+            return 3
+        if m in ('push', 'pop', 'ldm', 'ldmia', 'stm', 'stmia'):
+            num_regs = len(re.findall(r'r\d+|lr|pc', self.operands))
+            return 1 + num_regs + (3 if 'pc' in self.operands else 0)
+        raise ValueError('Unknown instruction timing: %s %s' % (self.mnemonic, self.operands))
+
+    def __str__(self):
+        return '%08x: %s %s' % (self.address, self.mnemonic, self.operands)
+
+
+def disassemble(objdump, elf):
+    """
+    runPump() is placed in .data to run from RAM, see board.cpp, and "objdump -d" only disassembles the executable
+    sections, hence -D. The disassembly of .data runs on into the literal pool and the variables after the function,
+    so the function is cut at its return instruction.
+    """
+    output = subprocess.check_output([objdump, '-D', '-j', RUN_PUMP_SECTION, '-M', 'force-thumb',
+                                      '--no-show-raw-insn', elf]).decode()
+    functions = {}
+    current = None
+    for line in output.splitlines():
+        m = FUNCTION_RE.match(line.strip())
+        if m:
+            current = functions.setdefault(m.group(2), [])
+            continue
+        if not line.strip():
+            current = None
+            continue
+        if current is not None:
+            m = INSTRUCTION_RE.match(line)
+            if m and not m.group(2).startswith('.'):
+                insn = Instruction(int(m.group(1), 16), m.group(2), m.group(3))
+                current.append(insn)
+                if insn.is_return:
+                    current = None
+    return functions
+
+
+def sum_cycles(instructions):
+    # Forward conditional branches leave the loops (e.g. the pump stop check), so they are not taken while pumping
+    return sum(x.cycles(not (x.is_conditional_branch and x.branch_target > x.address)) for x in instructions)
+
+
+def analyze(code):
+    index = dict((x.address, i) for i, x in enumerate(code))
+
+    # Delay loops are backward conditional branches whose body contains no other branches
+    loops = []
+    for i, x in enumerate(code):
+        if x.is_conditional_branch and x.branch_target <= x.address:
+            start = index[x.branch_target]
+            body = code[start:i + 1]
+            if not any(y.is_branch for y in body[:-1]):
+                loops.append((start, i))
+
+    outer = [(index[x.branch_target], i) for i, x in enumerate(code)
+             if x.is_conditional_branch and x.branch_target <= x.address and
+             (index[x.branch_target], i) not in loops]
+
+    if len(loops) != 2 or len(outer) != 1:
+        raise ValueError('Unexpected structure: %d delay loops, %d outer loops' % (len(loops), len(outer)))
+
+    (on_start, on_end), (off_start, off_end) = loops
+    outer_start, outer_end = outer[0]
+
+    on_store = max(i for i in range(outer_start, on_start) if code[i].is_store)
+    off_store = min(i for i in range(on_end + 1, off_start) if code[i].is_store)
+
+    on_loop = code[on_start:on_end + 1]
+    off_loop = code[off_start:off_end + 1]
+
+    # The last iteration of a delay loop falls through, so the branch takes fewer cycles
+    fallthrough_saving = on_loop[-1].cycles(True) - on_loop[-1].cycles(False)
+
+    on_overhead = (sum_cycles(code[on_store + 1:on_start]) - fallthrough_saving +
+                   sum_cycles(code[on_end + 1:off_store + 1]))
+
+    off_overhead = (sum_cycles(code[off_store + 1:off_start]) - fallthrough_saving +
+                    sum_cycles(code[off_end + 1:outer_end + 1]) +
+                    sum_cycles(code[outer_start:on_store + 1]))
+
+    return sum_cycles(on_loop), sum_cycles(off_loop), on_overhead, off_overhead
+
+
+def read_expected(header):
+    with open(header) as f:
+        text = f.read()
+    values = {}
+    for name in ('PumpIterationNs', 'PumpOnOverheadNs', 'PumpOffOverheadNs'):
+        m = re.search(r'\b%s\s*=\s*(\d+)\s*;' % name, text)
+        if not m:
+            raise ValueError('%s is not defined in %s' % (name, header))
+        values[name] = int(m.group(1))
+    return values
+
+
+def cycles_to_ns(cycles):
+    return int(round(cycles * 1e9 / CPU_CLOCK_HZ))
+
+
+def ns_to_cycles(ns):
+    return int(round(ns * CPU_CLOCK_HZ / 1e9))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Checks the timing of board::runPump() against board.hpp')
+    parser.add_argument('elf', help='firmware ELF file')
+    parser.add_argument('--objdump', default='arm-none-eabi-objdump', help='objdump executable')
+    parser.add_argument('--header', default='src/sys/board.hpp', help='header defining the expected constants')
+    parser.add_argument('--overhead-tolerance-cycles', type=int, default=2,
+                        help='allowed deviation of the overheads; the per-iteration time must match exactly')
+    args = parser.parse_args()
+
+    functions = disassemble(args.objdump, args.elf)
+    if not functions:
+        print('runPump() not found in the %s section of %s; it must run from RAM, see src/sys/board.cpp' %
+              (RUN_PUMP_SECTION, args.elf), file=sys.stderr)
+        return 1
+    if len(functions) != 1:
+        print('runPump(): expected exactly one instance in %s, found: %s' % (args.elf, list(functions.keys())),
+              file=sys.stderr)
+        return 1
+
+    name, code = list(functions.items())[0]
+    on_loop, off_loop, on_overhead, off_overhead = analyze(code)
+
+    print('runPump() timing in %s at %.0f MHz:' % (name, CPU_CLOCK_HZ / 1e6))
+    print('    Ton  = delay_on  * %d + %d cycles' % (on_loop, on_overhead))
+    print('    Toff = delay_off * %d + %d cycles' % (off_loop, off_overhead))
+    print('    PumpIterationNs   = %d' % cycles_to_ns(on_loop))
+    print('    PumpOnOverheadNs  = %d' % cycles_to_ns(on_overhead))
+    print('    PumpOffOverheadNs = %d' % cycles_to_ns(off_overhead))
+
+    expected = read_expected(args.header)
+    errors = []
+    if on_loop != off_loop:
+        errors.append('on and off delay loops differ: %d vs %d cycles' % (on_loop, off_loop))
+    if cycles_to_ns(on_loop) != expected['PumpIterationNs']:
+        errors.append('PumpIterationNs is %d, the code takes %d' % (expected['PumpIterationNs'],
+                                                                    cycles_to_ns(on_loop)))
+    for name, cycles in (('PumpOnOverheadNs', on_overhead), ('PumpOffOverheadNs', off_overhead)):
+        if abs(cycles - ns_to_cycles(expected[name])) > args.overhead_tolerance_cycles:
+            errors.append('%s is %d, the code takes %d' % (name, expected[name], cycles_to_ns(cycles)))
+
+    for e in errors:
+        print('runPump() timing mismatch: %s' % e, file=sys.stderr)
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
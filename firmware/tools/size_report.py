@@ -0,0 +1,264 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2016 Zubax Robotics, zubax.com
+#
+# Flash and RAM usage report of the firmware by module, built from the linker map file.
+# The usage can be compared against a stored baseline, and the script exits with a non-zero status if the total
+# usage exceeds the budget, or if the growth relative to the baseline exceeds the allowed limit. Without a baseline
+# only the budget is checked.
+#
+# Since the firmware is linked with LTO, the object file names in the map refer to the LTO partitions rather than
+# to the source files, so the bytes are attributed by the symbol names (the build uses -ffunction-sections and
+# -fdata-sections). Sections without a symbol name are attributed by the object file where possible.
+#
+
+from __future__ import print_function, division
+import argparse
+import json
+import os
+import re
+import sys
+
+# The default budgets are the FLASH and RAM regions of the linker script; the RAM budget excludes the bytes above
+# __stack_end (reserved for the IAP) and the stack reserve
+DEFAULT_LINKER_SCRIPT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'lpc11c24.ld')
+STACK_RESERVE = 1024
+
+DEFAULT_MAX_GROWTH = 256
+
+FLASH_SECTIONS = ['startup', 'constructors', '.text', '.ARM.extab', '.ARM.exidx', '.eh_frame_hdr', '.eh_frame',
+                  '.textalign']
+DATA_SECTIONS = ['.data']                   # Loaded from flash into RAM
+RAM_SECTIONS = ['.bss']
+
+# Rules are tried in order, the first match wins. Each rule is (module, symbol regex, object file regex).
+RULES = [
+    ('runPump (.data)', r'runPump',                                     None),      # Only applied to .data
+    ('uavcan driver',   r'uavcan_lpc11c24',                             None),
+    ('dsdl',            r'^_Z[A-Z]*N6uavcan(8protocol|9equipment)',     None),
+    ('libuavcan',       r'uavcan',                                      r'^uc_'),
+    ('magnet',          r'N6magnet|N7charger',                          r'^(magnet|charger)\.o$'),
+    ('params',          r'N6params',                                    r'^params\.o$'),
+    ('board',           r'N5board|N8profiler|_IRQHandler$|^Reset_Handler$|^SystemInit$|^vectors$',
+                                                                        r'^(board|profiler|crt0)\.o$'),
+    ('chip lib',        r'^Chip_|^RingBuffer_',                         r'(_11xx|^ring_buffer)\.o$'),
+    ('main',            r'^_ZN12_GLOBAL__N_1|^main$',                   r'^main\.o$'),
+    ('toolchain libs',  None,                                           r'lib(c|c_nano|gcc|stdc\+\+|m)\.a\('),
+]
+OTHER = 'other'
+FILL = 'alignment'
+
+INPUT_SECTION_RE = re.compile(r'^ ([^\s*][^\s]*)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(.+))?$')
+CONTINUATION_RE = re.compile(r'^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(.+)$')
+FILL_RE = re.compile(r'^ \*fill\*\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)')
+OUTPUT_SECTION_RE = re.compile(r'^([^\s]+)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+))?')
+
+MEMORY_REGION_RE = re.compile(r'^\s*(\w+)\s*\([^)]*\)\s*:\s*ORIGIN\s*=\s*\w+\s*,\s*LENGTH\s*=\s*(\w+)', re.M)
+STACK_END_RE = re.compile(r'__stack_end\s*=\s*ORIGIN\(RAM\)\s*\+\s*LENGTH\(RAM\)\s*-\s*(\w+)')
+
+
+def classify(output_section, input_section, obj):
+    # .text._ZN5board4initEv -> _ZN5board4initEv; vectors -> vectors
+    parts = input_section.lstrip('.').split('.', 1)
+    symbol = parts[1] if len(parts) > 1 else parts[0]
+    if symbol.startswith('str1.') or symbol in ('text', 'data', 'bss', 'rodata', 'COMMON'):
+        symbol = ''
+    obj = os.path.basename(obj.strip())
+
+    for module, symbol_re, obj_re in RULES:
+        if module.startswith('runPump') and output_section not in DATA_SECTIONS:
+            continue
+        if symbol and symbol_re and re.search(symbol_re, symbol):
+            return module
+        if obj_re and re.search(obj_re, obj):
+            return module
+    return OTHER
+
+
+def parse_number(text):
+    """Parses a linker script number: decimal, octal or hex, with an optional K or M suffix."""
+    multiplier = {'K': 1024, 'M': 1024 * 1024}.get(text[-1].upper(), 1)
+    if multiplier != 1:
+        text = text[:-1]
+    return int(text, 0) * multiplier
+
+
+def parse_linker_script(path):
+    """Returns (flash_budget, ram_budget) derived from the MEMORY regions of the linker script."""
+    with open(path) as f:
+        script = re.sub(r'/\*.*?\*/', '', f.read(), flags=re.S)
+
+    regions = dict((m.group(1), parse_number(m.group(2))) for m in MEMORY_REGION_RE.finditer(script))
+    if 'FLASH' not in regions or 'RAM' not in regions:
+        raise ValueError('%s does not define the FLASH and RAM memory regions' % path)
+
+    m = STACK_END_RE.search(script)
+    ram_top_reserve = parse_number(m.group(1)) if m else 0
+
+    return regions['FLASH'], regions['RAM'] - ram_top_reserve - STACK_RESERVE
+
+
+def parse_map(path):
+    """Returns ({module: [flash, ram]}, total_flash, total_ram)."""
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    try:
+        lines = lines[lines.index('Linker script and memory map') + 1:]
+    except ValueError:
+        raise ValueError('%s does not look like a GNU ld map file' % path)
+
+    usage = {}
+    totals = {'flash': 0, 'ram': 0}
+    output_section = None
+    pending = None
+
+    def account(module, size):
+        flash = size if output_section in FLASH_SECTIONS + DATA_SECTIONS else 0
+        ram = size if output_section in DATA_SECTIONS + RAM_SECTIONS else 0
+        entry = usage.setdefault(module, [0, 0])
+        entry[0] += flash
+        entry[1] += ram
+
+    for line in lines:
+        if not line.strip():
+            continue
+
+        if not line.startswith(' '):
+            m = OUTPUT_SECTION_RE.match(line)
+            output_section = m.group(1)
+            pending = None
+            if m.group(3) and output_section in FLASH_SECTIONS + DATA_SECTIONS + RAM_SECTIONS:
+                size = int(m.group(3), 16)
+                if output_section in FLASH_SECTIONS + DATA_SECTIONS:
+                    totals['flash'] += size
+                if output_section in DATA_SECTIONS + RAM_SECTIONS:
+                    totals['ram'] += size
+            continue
+
+        if output_section not in FLASH_SECTIONS + DATA_SECTIONS + RAM_SECTIONS:
+            continue
+
+        m = FILL_RE.match(line)
+        if m:
+            account(FILL, int(m.group(2), 16))
+            continue
+
+        if pending is not None:
+            m = CONTINUATION_RE.match(line)
+            if m:
+                account(classify(output_section, pending, m.group(3)), int(m.group(2), 16))
+            pending = None
+            continue
+
+        m = INPUT_SECTION_RE.match(line)
+        if m:
+            if m.group(2) is None:
+                pending = m.group(1)            # Long name, the address and size are on the next line
+            else:
+                account(classify(output_section, m.group(1), m.group(4)), int(m.group(3), 16))
+
+    return usage, totals['flash'], totals['ram']
+
+
+def load_baseline(path):
+    with open(path) as f:
+        return json.load(f)
+
+
+def save_baseline(path, usage, total_flash, total_ram):
+    data = {
+        'modules': dict((k, {'flash': v[0], 'ram': v[1]}) for k, v in usage.items()),
+        'total': {'flash': total_flash, 'ram': total_ram}
+    }
+    with open(path, 'w') as f:
+        json.dump(data, f, indent=4, sort_keys=True)
+        f.write('\n')
+
+
+def format_delta(current, baseline):
+    if baseline is None:
+        return ''
+    delta = current - baseline
+    return '%+d' % delta if delta else '='
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Reports flash and RAM usage of the firmware by module')
+    parser.add_argument('map', help='linker map file')
+    parser.add_argument('--baseline', help='baseline file to compare against; ignored if it does not exist')
+    parser.add_argument('--write-baseline', metavar='PATH', help='store the current usage as the baseline')
+    parser.add_argument('--linker-script', default=DEFAULT_LINKER_SCRIPT,
+                        help='linker script the default budgets are derived from, default %(default)s')
+    parser.add_argument('--flash-budget', type=int, help='bytes, default the FLASH region of the linker script')
+    parser.add_argument('--ram-budget', type=int,
+                        help='bytes, default the RAM region of the linker script, minus the IAP reserve above '
+                             '__stack_end and %d bytes of stack' % STACK_RESERVE)
+    parser.add_argument('--max-growth', type=int, default=DEFAULT_MAX_GROWTH,
+                        help='maximum allowed growth of the total flash or RAM usage over the baseline, bytes, '
+                             'default %(default)s; negative to disable')
+    args = parser.parse_args()
+
+    usage, total_flash, total_ram = parse_map(args.map)
+
+    if args.flash_budget is None or args.ram_budget is None:
+        flash_budget, ram_budget = parse_linker_script(args.linker_script)
+        if args.flash_budget is None:
+            args.flash_budget = flash_budget
+        if args.ram_budget is None:
+            args.ram_budget = ram_budget
+
+    if args.write_baseline:
+        save_baseline(args.write_baseline, usage, total_flash, total_ram)
+        print('Baseline written to %s' % args.write_baseline)
+        return 0
+
+    baseline = None
+    if args.baseline and os.path.exists(args.baseline):
+        baseline = load_baseline(args.baseline)
+    elif args.baseline:
+        print('Baseline %s does not exist, the growth is not checked; run "make size-baseline" on a clean build '
+              'and commit it' % args.baseline, file=sys.stderr)
+
+    def baseline_of(module, index):
+        if baseline is None:
+            return None
+        entry = baseline['modules'].get(module, {'flash': 0, 'ram': 0})
+        return entry['flash' if index == 0 else 'ram']
+
+    modules = sorted(set(usage.keys()) | set(baseline['modules'].keys() if baseline else []),
+                     key=lambda k: -usage.get(k, [0, 0])[0])
+
+    row = '%-18s %8s %8s %8s %8s'
+    print(row % ('Module', 'Flash', 'delta', 'RAM', 'delta'))
+    for module in modules:
+        flash, ram = usage.get(module, [0, 0])
+        print(row % (module, flash, format_delta(flash, baseline_of(module, 0)),
+                     ram, format_delta(ram, baseline_of(module, 1))))
+
+    base_flash = baseline['total']['flash'] if baseline else None
+    base_ram = baseline['total']['ram'] if baseline else None
+    print(row % ('Total', total_flash, format_delta(total_flash, base_flash),
+                 total_ram, format_delta(total_ram, base_ram)))
+    print(row % ('Budget', args.flash_budget, '', args.ram_budget, ''))
+    print(row % ('Free', args.flash_budget - total_flash, '', args.ram_budget - total_ram, ''))
+
+    errors = []
+    if total_flash > args.flash_budget:
+        errors.append('flash usage %d exceeds the budget of %d bytes' % (total_flash, args.flash_budget))
+    if total_ram > args.ram_budget:
+        errors.append('RAM usage %d exceeds the budget of %d bytes' % (total_ram, args.ram_budget))
+    if baseline and args.max_growth >= 0:
+        if total_flash - base_flash > args.max_growth:
+            errors.append('flash usage grew by %d bytes, the limit is %d' % (total_flash - base_flash,
+                                                                              args.max_growth))
+        if total_ram - base_ram > args.max_growth:
+            errors.append('RAM usage grew by %d bytes, the limit is %d' % (total_ram - base_ram, args.max_growth))
+
+    for e in errors:
+        print('Size check failed: %s' % e, file=sys.stderr)
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,166 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2016 Zubax Robotics, zubax.com
+#
+# Decodes the binary syslog output of the firmware built with TOKENIZED_SYSLOG=1 back into the text.
+# The texts of the messages are not stored in the flash; they are kept in the .syslog_dict section of the ELF,
+# and every record carries the offset of its text in that section (see BOARD_SYSLOG() in src/sys/board.hpp).
+#
+# Record format, all multi-byte fields are little endian:
+#     sync (0xA5), payload length, token (16 bit), timestamp in milliseconds (16 bit), payload, checksum
+# The payload is the integer value as a zigzag varint, which replaces the %d placeholder of the text, or the text
+# itself if the token is 0xFFFF. The checksum is the XOR of all bytes after the sync byte.
+#
+# Usage:
+#     tools/syslog_decode.py build/firmware.elf --port /dev/ttyUSB0
+#     tools/syslog_decode.py build/syslog_dict.bin < captured.bin
+#
+
+from __future__ import print_function, division
+import argparse
+import struct
+import sys
+
+RECORD_SYNC = 0xA5
+TEXT_TOKEN = 0xFFFF
+RECORD_OVERHEAD = 7
+PLACEHOLDER = '%d'
+DICT_SECTION = b'.syslog_dict'
+
+
+def read_elf_section(data, name):
+    if data[4:5] != b'\x01' or data[5:6] != b'\x01':
+        raise ValueError('Only little endian ELF32 files are supported')
+
+    shoff, = struct.unpack_from('<I', data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+
+    def header(index):
+        # name, type, flags, addr, offset, size
+        return struct.unpack_from('<IIIIII', data, shoff + index * shentsize)
+
+    strtab_offset = header(shstrndx)[4]
+    for i in range(shnum):
+        name_offset, _, _, _, offset, size = header(i)
+        start = strtab_offset + name_offset
+        if data[start:data.index(b'\0', start)] == name:
+            return data[offset:offset + size]
+    raise ValueError('Section %s not found, was the firmware built with TOKENIZED_SYSLOG=1?' % name.decode())
+
+
+def load_dict(path):
+    """Accepts either the firmware ELF or the dictionary extracted with --write-dict."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data.startswith(b'\x7fELF'):
+        return read_elf_section(data, DICT_SECTION)
+    return data
+
+
+def lookup(dictionary, token):
+    if token >= len(dictionary):
+        return '<unknown token %d>' % token
+    end = dictionary.index(b'\0', token)
+    return dictionary[token:end].decode('ascii', 'replace')
+
+
+def decode_zigzag_varint(payload):
+    value = 0
+    for i, b in enumerate(bytearray(payload)):
+        value |= (b & 0x7F) << (7 * i)
+    return (value >> 1) ^ -(value & 1)
+
+
+def parse_records(read):
+    """
+    Yields (timestamp_ms, token, payload); skips the garbage and resynchronizes on checksum errors.
+    The read callable returns None at the end of the input.
+    """
+    buf = bytearray()
+    while True:
+        chunk = read()
+        if chunk is None:
+            return
+        buf += bytearray(chunk)
+
+        while True:
+            try:
+                start = buf.index(RECORD_SYNC)
+            except ValueError:
+                del buf[:]
+                break
+            del buf[:start]
+
+            if len(buf) < 2 or len(buf) < buf[1] + RECORD_OVERHEAD:
+                break
+
+            length = buf[1] + RECORD_OVERHEAD
+            checksum = 0
+            for b in buf[1:length - 1]:
+                checksum ^= b
+            if checksum != buf[length - 1]:
+                del buf[:1]
+                continue
+
+            token, timestamp = struct.unpack_from('<HH', bytes(buf), 2)
+            yield timestamp, token, bytes(buf[6:length - 1])
+            del buf[:length]
+
+
+def format_record(dictionary, token, payload):
+    if token == TEXT_TOKEN:
+        return payload.decode('ascii', 'replace')
+    text = lookup(dictionary, token)
+    if payload:
+        text = text.replace(PLACEHOLDER, str(decode_zigzag_varint(payload)), 1)
+    return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decodes the tokenized syslog output of the firmware')
+    parser.add_argument('dict', help='firmware ELF file or extracted dictionary')
+    parser.add_argument('input', nargs='?', help='captured binary output, stdin by default')
+    parser.add_argument('--port', help='serial port to read from instead of the input, requires pyserial')
+    parser.add_argument('--baudrate', type=int, default=115200, help='default %(default)s')
+    parser.add_argument('--write-dict', metavar='PATH', help='extract the dictionary from the ELF and exit')
+    parser.add_argument('--no-timestamps', action='store_true', help='do not prefix the lines with the time')
+    args = parser.parse_args()
+
+    dictionary = load_dict(args.dict)
+
+    if args.write_dict:
+        with open(args.write_dict, 'wb') as f:
+            f.write(dictionary)
+        print('Syslog dictionary written to %s, %d bytes' % (args.write_dict, len(dictionary)))
+        return 0
+
+    if args.port:
+        import serial
+        port = serial.Serial(args.port, args.baudrate, timeout=0.1)
+        read = lambda: port.read(256)           # Empty on timeout, never ends
+    else:
+        stream = open(args.input, 'rb') if args.input else getattr(sys.stdin, 'buffer', sys.stdin)
+        read = lambda: stream.read(256) or None
+
+    # The timestamps wrap around every 65.5 seconds
+    epoch_ms = 0
+    last_timestamp = None
+    at_line_start = True
+
+    for timestamp, token, payload in parse_records(read):
+        if last_timestamp is not None and timestamp < last_timestamp:
+            epoch_ms += 0x10000
+        last_timestamp = timestamp
+
+        for c in format_record(dictionary, token, payload).replace('\r', ''):
+            if at_line_start and c != '\n' and not args.no_timestamps:
+                sys.stdout.write('[%9.3f] ' % ((epoch_ms + timestamp) / 1000))
+            sys.stdout.write(c)
+            at_line_start = c == '\n'
+        sys.stdout.flush()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())